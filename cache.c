@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+void cache_init(Cache *cache, size_t max)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->max = max;
+}
+
+void cache_deinit(Cache *cache)
+{
+    CacheEntry *next;
+    for (CacheEntry *entry = cache->head; entry; entry = next) {
+        next = entry->next;
+        image_release(entry->image);
+        free(entry);
+    }
+    cache_init(cache, cache->max);
+}
+
+// The digest is already uniformly spread, its first bytes will do
+static CacheEntry **bucket(Cache *cache, const uint8_t *digest)
+{
+    uint32_t hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return &cache->buckets[hash & (CACHE_BUCKETS - 1)];
+}
+
+static void lru_unlink(Cache *cache, CacheEntry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+}
+
+static void lru_push(Cache *cache, CacheEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+}
+
+static void evict(Cache *cache, CacheEntry *entry)
+{
+    CacheEntry **link = bucket(cache, entry->digest);
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    lru_unlink(cache, entry);
+    cache->stats[CACHE_EVICTIONS]++;
+    cache->stats[CACHE_ENTRIES]--;
+    cache->stats[CACHE_INSTRUCTIONS] -= (uint32_t)program_size(&entry->image->program);
+    image_release(entry->image);
+    free(entry);
+}
+
+static CacheEntry *lookup(Cache *cache, const uint8_t *digest)
+{
+    CacheEntry *entry = *bucket(cache, digest);
+    while (entry && memcmp(entry->digest, digest, SHA256_SIZE))
+        entry = entry->chain;
+
+    if (entry) {
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+    }
+    return entry;
+}
+
+// Image named digest, NULL if there is none. Counts as a use
+CacheEntry *cache_find(Cache *cache, const uint8_t *digest)
+{
+    CacheEntry *entry = lookup(cache, digest);
+    cache->stats[entry ? CACHE_HITS : CACHE_MISSES]++;
+    return entry;
+}
+
+// Keep a copy of the size instructions of insts named digest, the
+// least recently used images make room. NULL if it is larger than the
+// whole cache or can't be allocated
+CacheEntry *cache_insert(Cache *cache, const uint8_t *digest, const Instruction *insts, size_t size)
+{
+    CacheEntry *entry = lookup(cache, digest);
+    if (entry)
+        return entry;
+
+    if (size > cache->max)
+        return NULL;
+
+    while (cache->tail && (cache->stats[CACHE_ENTRIES] >= CACHE_ENTRIES_MAX
+                || cache->stats[CACHE_INSTRUCTIONS] + size > cache->max)) {
+        evict(cache, cache->tail);
+    }
+
+    entry = (CacheEntry *)malloc(sizeof(CacheEntry));
+    if (!entry)
+        return NULL;
+    entry->image = image_new(insts, size);
+    if (!entry->image) {
+        free(entry);
+        return NULL;
+    }
+
+    memcpy(entry->digest, digest, SHA256_SIZE);
+
+    CacheEntry **link = bucket(cache, digest);
+    entry->chain = *link;
+    *link = entry;
+    lru_push(cache, entry);
+
+    cache->stats[CACHE_INSERTS]++;
+    cache->stats[CACHE_ENTRIES]++;
+    cache->stats[CACHE_INSTRUCTIONS] += (uint32_t)size;
+    return entry;
+}
+
+// VMs bound to the images of the cache, those of evicted images are
+// not counted
+uint32_t cache_bound(Cache *cache)
+{
+    uint32_t bound = 0;
+    for (CacheEntry *entry = cache->head; entry; entry = entry->next)
+        bound += entry->image->refs - 1;
+    return bound;
+}
@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "program.h"
+#include "sha256.h"
+#include "vm.h"
+
+#define CACHE_ENTRIES_MAX 1024 // images held at most
+#define CACHE_BUCKETS (2 * CACHE_ENTRIES_MAX) // a power of two
+
+// Counters read by DUMP with the DUMP_CACHE section
+typedef enum {
+    CACHE_HITS,
+    CACHE_MISSES,
+    CACHE_INSERTS,
+    CACHE_EVICTIONS,
+    CACHE_ENTRIES,
+    CACHE_INSTRUCTIONS, // held by the entries
+    CACHE_BOUND, // VMs running an image, counted by cache_bound()
+    CACHE_STAT_COUNT
+} CacheStat;
+
+// A program image named by the SHA-256 of its instructions. The entry
+// holds a reference to it, an evicted image lives on while VMs are
+// bound to it
+typedef struct CacheEntry {
+    uint8_t digest[SHA256_SIZE];
+    struct CacheEntry *chain; // next in the bucket
+    struct CacheEntry *prev; // more recently used
+    struct CacheEntry *next; // less recently used
+    Image *image;
+} CacheEntry;
+
+// Content-addressed program images, so that a program uploaded once
+// is bound to other VMs by its digest alone. Holds no more than max
+// instructions and CACHE_ENTRIES_MAX images, the least recently used
+// go first. Not thread safe, every worker has its own
+typedef struct {
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry *head; // most recently used
+    CacheEntry *tail;
+    size_t max; // instructions, 0 disables the cache
+    uint32_t stats[CACHE_STAT_COUNT];
+} Cache;
+
+void cache_init(Cache *cache, size_t max);
+void cache_deinit(Cache *cache);
+CacheEntry *cache_find(Cache *cache, const uint8_t *digest);
+CacheEntry *cache_insert(Cache *cache, const uint8_t *digest, const Instruction *insts, size_t size);
+uint32_t cache_bound(Cache *cache);
+
+#endif
@@ -2,8 +2,10 @@
 #include <string.h>
 
 #include "program.h"
+#include "client.h"
 #include "server.h"
 #include "utils.h"
+#include "sha256.h"
 
 bool client_merge_all(int fd, Program *program)
 {
@@ -29,16 +31,110 @@ bool client_merge_all(int fd, Program *program)
         count++;
     }
 
+    // Drain every reply so the connection stays in sync
+    bool rv = true;
     for (size_t i = 0; i < count; i++) {
         read_all(fd, &res.header, sizeof(res.header));
-        if (res.header.status == FAILURE)
-            return false;
         read_all(fd, res.payload, res.header.size);
+        if (res.header.status == FAILURE)
+            rv = false;
     }
 
+    return rv;
+}
+
+// Upload the whole program in version 2 frames, see client_hello().
+// Unlike client_merge_all() the program is left as it is, the frames
+// are written from it and answered once
+bool client_upload(int fd, Program *program)
+{
+    Instruction *insts = program_data(program);
+    size_t left = program_size(program);
+
+    do {
+        size_t n = MIN(left, FRAME_MAX / sizeof(Instruction));
+        left -= n;
+
+        RequestHeader header = {
+            .type = left ? MERGE | FRAME_MORE : MERGE,
+            .size = n * sizeof(Instruction),
+        };
+        write_all(fd, &header, sizeof(header));
+        write_all(fd, insts, header.size);
+        insts += n;
+    } while (left);
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+    return res.header.status == SUCCESS;
+}
+
+// Replace the program with the image the server cached as digest,
+// false if it has none
+bool client_bind(int fd, const uint8_t *digest)
+{
+    Request req;
+    req.header = (RequestHeader) {
+        .type = BIND,
+        .size = SHA256_SIZE,
+    };
+    memcpy(req.payload, digest, SHA256_SIZE);
+    write_all(fd, &req, sizeof(req.header) + req.header.size);
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+    return res.header.status == SUCCESS;
+}
+
+// Have the server cache the program, digest is what it named it
+bool client_publish(int fd, uint8_t *digest)
+{
+    Request req;
+    req.header = (RequestHeader) {
+        .type = PUBLISH,
+        .size = 0,
+    };
+    write_all(fd, &req, sizeof(req.header));
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+    if (res.header.status != SUCCESS)
+        return false;
+
+    memcpy(digest, res.payload, SHA256_SIZE);
     return true;
 }
 
+// Replace the program with program, sending only its digest when the
+// server has it cached. Otherwise it is uploaded in version 2 frames
+// and cached for the next time, hit tells which happened
+bool client_upload_cached(int fd, Program *program, bool *hit)
+{
+    uint8_t digest[SHA256_SIZE];
+    sha256(program_data(program), program_size(program) * sizeof(Instruction), digest);
+
+    *hit = client_bind(fd, digest);
+    if (*hit)
+        return true;
+
+    Request req;
+    req.header = (RequestHeader) {
+        .type = RESET,
+        .size = 0,
+    };
+    Response res;
+    write_all(fd, &req, sizeof(req.header));
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+
+    uint8_t published[SHA256_SIZE];
+    return client_upload(fd, program) && client_publish(fd, published)
+        && !memcmp(published, digest, SHA256_SIZE);
+}
+
 bool client_insert(int fd, Program *program, uint32_t start)
 {
     Request req;
@@ -66,56 +162,181 @@ bool client_insert(int fd, Program *program, uint32_t start)
         count++;
     }
 
+    // Drain every reply so the connection stays in sync
+    bool rv = true;
     for (size_t i = 0; i < count; i++) {
         read_all(fd, &res.header, sizeof(res.header));
-        if (res.header.status == FAILURE)
-            return false;
         read_all(fd, res.payload, res.header.size);
+        if (res.header.status == FAILURE)
+            rv = false;
     }
 
-    return true;
+    return rv;
 }
 
+// Fetch the program, as much of it per GET as the framing allows. The
+// instructions are read straight into program
 void client_get_all(int fd, Program *program)
 {
     uint32_t offset = 0;
-    const uint32_t chunk = PAYLOAD_SIZE / sizeof(Instruction);
 
     Request req;
     Response res;
 
-    do {
+    while (1) {
         req.header = (RequestHeader) {
             .type = GET,
             .size = 2 * sizeof(uint32_t),
         };
         ((uint32_t *)req.payload)[0] = offset;
-        ((uint32_t *)req.payload)[1] = chunk;
+        ((uint32_t *)req.payload)[1] = UINT32_MAX;
         write_all(fd, &req, sizeof(req.header) + req.header.size);
 
-        read_all(fd, &res, sizeof(res.header));
-        read_all(fd, res.payload, res.header.size);
-        program_merge(program, (Instruction *)res.payload,
-                res.header.size / sizeof(Instruction));
+        if (!read_all(fd, &res, sizeof(res.header)))
+            break;
+        if (res.header.status != SUCCESS) {
+            read_all(fd, res.payload, res.header.size);
+            break;
+        }
 
-        offset += chunk;
-    } while (res.header.status == SUCCESS);
+        size_t n = res.header.size / sizeof(Instruction);
+        Instruction *dst = program_reserve(program, n);
+        if (!dst) {
+            break;
+        }
+        read_all(fd, dst, res.header.size);
+        program_extend(program, n);
+
+        offset += n;
+    }
 }
 
 bool client_exec(int fd)
+{
+    return client_exec_args(fd, NULL, 0);
+}
+
+// Run the loaded program with n arguments, see vm_setargs()
+bool client_exec_args(int fd, const int32_t *args, uint32_t n)
 {
     Request req;
     req.header = (RequestHeader) {
         .type = EXEC,
-        .size = 0,
+        .size = n * sizeof(int32_t),
     };
-    write_all(fd, &req, sizeof(req.header));
+    if (n)
+        memcpy(req.payload, args, req.header.size);
+    write_all(fd, &req, sizeof(req.header) + req.header.size);
 
     Response res;
     read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
     if (res.header.status == FAILURE)
         return false;
+    return true;
+}
+
+// Run program, or the one loaded when NULL, in one round trip, see
+// RunHeader. The words of the ranges follow each other in words, false
+// if the server refused to run it
+bool client_run(int fd, Program *program, RunPoke *pokes, uint32_t npokes,
+        RunRange *ranges, uint32_t nranges, RunResult *result, int32_t *words)
+{
+    size_t n = program ? program_size(program) : 0;
+    RunHeader args = { npokes, nranges };
+    RequestHeader header = {
+        .type = RUN,
+        .size = sizeof(args) + npokes * sizeof(RunPoke)
+            + nranges * sizeof(RunRange) + n * sizeof(Instruction),
+    };
+    write_all(fd, &header, sizeof(header));
+    write_all(fd, &args, sizeof(args));
+    write_all(fd, pokes, npokes * sizeof(RunPoke));
+    write_all(fd, ranges, nranges * sizeof(RunRange));
+    if (n)
+        write_all(fd, program_data(program), n * sizeof(Instruction));
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    if (res.header.status != SUCCESS) {
+        read_all(fd, res.payload, res.header.size);
+        return false;
+    }
+
+    read_all(fd, result, sizeof(*result));
+    read_all(fd, words, res.header.size - sizeof(*result));
+    return true;
+}
+
+// Ask for framing version, returns the one the server agreed on. Old
+// servers don't know HELLO and stay with version 1
+uint32_t client_hello(int fd, uint32_t version)
+{
+    Request req;
+    req.header = (RequestHeader) {
+        .type = HELLO,
+        .size = sizeof(uint32_t),
+    };
+    ((uint32_t *)req.payload)[0] = version;
+    write_all(fd, &req, sizeof(req.header) + req.header.size);
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+    if (res.header.status != SUCCESS || res.header.size < sizeof(uint32_t))
+        return 1;
+
+    return ((uint32_t *)res.payload)[0];
+}
+
+bool client_notify(int fd, bool on)
+{
+    Request req;
+    req.header = (RequestHeader) {
+        .type = NOTIFY,
+        .size = sizeof(uint32_t),
+    };
+    ((uint32_t *)req.payload)[0] = on;
+    write_all(fd, &req, sizeof(req.header) + req.header.size);
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+    return res.header.status == SUCCESS;
+}
+
+// Wait for the DONE of the last EXEC, see client_notify()
+bool client_done(int fd, ExecDone *done)
+{
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
+    if (res.header.status != DONE || res.header.size != sizeof(*done))
+        return false;
+
+    memcpy(done, res.payload, sizeof(*done));
+    return true;
+}
+
+// Ask for an address space of size words, size is updated with the
+// size the server granted
+bool client_setup(int fd, uint32_t *size)
+{
+    Request req;
+    req.header = (RequestHeader) {
+        .type = SETUP,
+        .size = sizeof(uint32_t),
+    };
+    ((uint32_t *)req.payload)[0] = *size;
+    write_all(fd, &req, sizeof(req.header) + req.header.size);
+
+    Response res;
+    read_all(fd, &res, sizeof(res.header));
     read_all(fd, res.payload, res.header.size);
+    if (res.header.status == FAILURE || res.header.size < sizeof(uint32_t))
+        return false;
+
+    *size = ((uint32_t *)res.payload)[0];
     return true;
 }
 
@@ -132,13 +353,18 @@ bool client_delete(int fd, uint32_t start, uint32_t size)
 
     Response res;
     read_all(fd, &res, sizeof(res.header));
+    read_all(fd, res.payload, res.header.size);
     if (res.header.status == FAILURE)
         return false;
-    read_all(fd, res.payload, res.header.size);
     return true;
 }
 
 bool client_dump(int fd, int32_t *memory, uint32_t size)
+{
+    return client_dump_section(fd, DUMP_MEMORY, memory, size);
+}
+
+bool client_dump_section(int fd, uint32_t section, int32_t *words, uint32_t size)
 {
     Response res;
     Request req;
@@ -148,19 +374,23 @@ bool client_dump(int fd, int32_t *memory, uint32_t size)
     while (size > 0) {
         req.header = (RequestHeader) {
             .type = DUMP,
-            .size = 2 * sizeof(uint32_t),
+            .size = 3 * sizeof(uint32_t),
         };
         ((uint32_t *)req.payload)[0] = offset;
         ((uint32_t *)req.payload)[1] = size;
+        ((uint32_t *)req.payload)[2] = section;
         write_all(fd, &req, sizeof(req.header) + req.header.size);
 
-        read_all(fd, &res, sizeof(res.header));
-        if (res.header.status == FAILURE)
+        if (!read_all(fd, &res, sizeof(res.header)))
             return false;
-        read_all(fd, res.payload, res.header.size);
-        size_t n = res.header.size / sizeof(int);
+        if (res.header.status == FAILURE) {
+            read_all(fd, res.payload, res.header.size);
+            return false;
+        }
 
-        memcpy(&memory[offset], &res.payload, res.header.size);
+        // No more than asked for, as much as the framing allows
+        size_t n = res.header.size / sizeof(int);
+        read_all(fd, &words[offset], res.header.size);
 
         offset += n;
         size -= n;
@@ -2,12 +2,25 @@
 #define CLIENT_H
 
 #include "program.h"
+#include "server.h"
 
 bool client_merge_all(int fd, Program *program);
+bool client_upload(int fd, Program *program);
+bool client_upload_cached(int fd, Program *program, bool *hit);
+bool client_bind(int fd, const uint8_t *digest);
+bool client_publish(int fd, uint8_t *digest);
 bool client_insert(int fd, Program *program, uint32_t start);
 bool client_exec(int fd);
+bool client_exec_args(int fd, const int32_t *args, uint32_t n);
+bool client_run(int fd, Program *program, RunPoke *pokes, uint32_t npokes,
+        RunRange *ranges, uint32_t nranges, RunResult *result, int32_t *words);
+bool client_setup(int fd, uint32_t *size);
+uint32_t client_hello(int fd, uint32_t version);
+bool client_notify(int fd, bool on);
+bool client_done(int fd, ExecDone *done);
 void client_get_all(int fd, Program *program);
 bool client_delete(int fd, uint32_t start, uint32_t size);
 bool client_dump(int fd, int32_t *memory, uint32_t size);
+bool client_dump_section(int fd, uint32_t section, int32_t *words, uint32_t size);
 
 #endif
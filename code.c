@@ -0,0 +1,413 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "code.h"
+
+bool code_init(Code *code)
+{
+    code->ops = (Op *)malloc(sizeof(Op));
+    if (code->ops == NULL)
+        return false;
+
+    code->capacity = 1;
+    code->size = 0;
+    memset(code->fused, 0, sizeof(code->fused));
+    memset(code->cfg, 0, sizeof(code->cfg));
+
+    return true;
+}
+
+bool code_deinit(Code *code)
+{
+    if (code == NULL || code->ops == NULL)
+        return false;
+
+    free(code->ops);
+    return true;
+}
+
+#define IN_MEMORY(arg) \
+        ((uint32_t)(arg) < memory_size)
+
+// Check the operands that are known before execution against an
+// address space of memory_size words, everything the interpreter
+// can't prove at runtime is rejected here
+InstResult code_verify_inst(Instruction *inst, uint32_t memory_size)
+{
+    switch (inst->code) {
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        if (IN_MEMORY(inst->dest) && IN_MEMORY(inst->arg1) && IN_MEMORY(inst->arg2))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case DIVI:
+        if (inst->arg2 == 0)
+            return DIVISION_BY_ZERO;
+        // fallthrough
+    case ADDI:
+    case SUBI:
+    case MULI:
+    case MOV:
+        if (IN_MEMORY(inst->dest) && IN_MEMORY(inst->arg1))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case HALLO:
+    case LOAD:
+    case STORE:
+        if (IN_MEMORY(inst->dest) && IN_MEMORY(inst->arg1))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case MCPY:
+    case MSET:
+    case VADD:
+    case VSUB:
+    case VMUL:
+    case VDOT:
+    case VSUM:
+    case VMIN:
+    case VMAX:
+    case VCMP:
+        if (IN_MEMORY(inst->dest) && IN_MEMORY(inst->arg1) && IN_MEMORY(inst->arg2))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case MOVI:
+    case PUSH:
+    case HFREE:
+    case POP:
+    case RET:
+        if (IN_MEMORY(inst->dest))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case BEQ:
+    case BNE:
+    case BGE:
+        if (IN_MEMORY(inst->arg1) && IN_MEMORY(inst->arg2))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case BEQI:
+    case BNEI:
+    case BGEI:
+        if (IN_MEMORY(inst->arg1))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case BLEI:
+        // blei compares arg1 <= memory[arg2]
+        if (IN_MEMORY(inst->arg2))
+            return OK;
+        return MEMORY_OVERFLOW;
+    case PUSHI:
+    case SALLO:
+    case SFREE:
+    case B:
+    case RETI:
+    case HALT:
+        return OK;
+    default:
+        return MALFORMED_INSTRUCTION;
+    }
+}
+
+#undef IN_MEMORY
+
+static bool is_branch(uint32_t code)
+{
+    switch (code) {
+    case B:
+    case BEQ:
+    case BEQI:
+    case BNE:
+    case BNEI:
+    case BGE:
+    case BGEI:
+    case BLEI:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether op may read memory[PC], LOAD, POP and the range ops compute
+// their addresses at runtime so they always may
+static bool reads_pc(Op *op)
+{
+    switch (op->code) {
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case BEQ:
+    case BNE:
+    case BGE:
+        return op->arg1 == PC || op->arg2 == PC;
+    case ADDI:
+    case SUBI:
+    case MULI:
+    case DIVI:
+    case MOV:
+    case HALLO:
+    case BEQI:
+    case BNEI:
+    case BGEI:
+        return op->arg1 == PC;
+    case BLEI:
+        return op->arg2 == PC;
+    case PUSH:
+    case RET:
+    case HFREE:
+        return op->dest == PC;
+    case STORE:
+        return op->dest == PC || op->arg1 == PC;
+    case POP:
+    case LOAD:
+    case MCPY:
+    case MSET:
+    case VADD:
+    case VSUB:
+    case VMUL:
+    case VDOT:
+    case VSUM:
+    case VMIN:
+    case VMAX:
+    case VCMP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether op may write memory[PC], that is jump somewhere the CFG
+// can't see
+static bool writes_pc(Op *op)
+{
+    switch (op->code) {
+    case ADD:
+    case ADDI:
+    case SUB:
+    case SUBI:
+    case MUL:
+    case MULI:
+    case DIV:
+    case DIVI:
+    case MOV:
+    case MOVI:
+    case POP:
+    case HALLO:
+    case LOAD:
+        return op->dest == PC;
+    case PUSH:
+    case PUSHI:
+    case STORE:
+    case MCPY:
+    case MSET:
+    case VADD:
+    case VSUB:
+    case VMUL:
+    case VDOT:
+    case VSUM:
+    case VMIN:
+    case VMAX:
+    case VCMP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Whether the instruction after op doesn't necessarily run next
+static bool ends_block(Op *op)
+{
+    return is_branch(op->code) || op->code == HALT || writes_pc(op);
+}
+
+// Flag the first op of every basic block by setting its block to 1,
+// code_blocks() fills in the real sizes once the ops are fused. Blocks
+// start at branch targets and after the ops that end one. The ops that
+// read PC start one too, so that its value is stored for them when the
+// block is entered rather than before every op
+static void mark_leaders(Code *code)
+{
+    Op *ops = code->ops;
+    size_t size = code->size;
+
+    memset(code->cfg, 0, sizeof(code->cfg));
+    if (size)
+        ops[0].block = 1;
+
+    for (size_t i = 0; i < size; i++) {
+        Op *op = &ops[i];
+
+        if (reads_pc(op))
+            op->block = 1;
+
+        if (is_branch(op->code)) {
+            ops[op->dest].block = 1;
+            if ((size_t)op->dest <= i)
+                code->cfg[CFG_BACK_EDGES]++;
+        }
+
+        if (ends_block(op) && i + 1 < size)
+            ops[i + 1].block = 1;
+
+        // Halting, jumping through PC or falling off the end
+        if (op->code == HALT || writes_pc(op) || (i + 1 == size && op->code != B))
+            code->cfg[CFG_EXITS]++;
+    }
+}
+
+// Verify a whole program, on failure index is set to the
+// offending instruction
+InstResult code_verify(Program *program, uint32_t memory_size, size_t *index)
+{
+    size_t size = program_size(program);
+    for (size_t i = 0; i < size; i++) {
+        Instruction *inst = program_fetch(program, i);
+
+        InstResult res = code_verify_inst(inst, memory_size);
+        if (res == OK && is_branch(inst->code) && inst->dest >= size)
+            res = MEMORY_OVERFLOW;
+
+        if (res != OK) {
+            *index = i;
+            return res;
+        }
+    }
+
+    return OK;
+}
+
+InstResult code_build(Code *code, Program *program, uint32_t memory_size,
+        const void **handlers, size_t *index)
+{
+    InstResult res = code_verify(program, memory_size, index);
+    if (res != OK)
+        return res;
+
+    // One more slot for the CODE_END op
+    size_t size = program_size(program);
+    if (size + 1 > code->capacity) {
+        Op *ops = (Op *)realloc(code->ops, (size + 1) * sizeof(Op));
+        if (ops == NULL) {
+            fprintf(stderr, "Failed to reallocate code vector\n");
+            *index = 0;
+            return MEMORY_OVERFLOW;
+        }
+        code->ops = ops;
+        code->capacity = size + 1;
+    }
+
+    for (size_t i = 0; i <= size; i++) {
+        Op *op = &code->ops[i];
+        if (i < size) {
+            Instruction *inst = program_fetch(program, i);
+            op->code = inst->code;
+            op->len = 1;
+            op->dest = (int32_t)inst->dest;
+            op->arg1 = (int32_t)inst->arg1;
+            op->arg2 = (int32_t)inst->arg2;
+        } else {
+            *op = (Op) { .code = CODE_END };
+        }
+        op->block = 0;
+        op->handler = handlers ? handlers[op->code] : NULL;
+    }
+    code->size = size;
+
+    mark_leaders(code);
+    code_fuse(code, handlers);
+    code_blocks(code, handlers);
+
+    return OK;
+}
+
+typedef struct {
+    uint32_t code; // enum FusedOpCode
+    uint32_t len;
+    uint32_t parts[3]; // enum OpCode
+} Fusion;
+
+// Longest patterns first so that they take precedence
+static const Fusion fusions[] = {
+    { ADD_MOV_MOV,  3, { ADD, MOV, MOV } },
+    { MOV_MOV_BEQI, 3, { MOV, MOV, BEQI } },
+    { MOV_SUBI,     2, { MOV, SUBI } },
+    { MOV_MOV,      2, { MOV, MOV } },
+    { SUBI_BEQI,    2, { SUBI, BEQI } },
+    { SUBI_BNEI,    2, { SUBI, BNEI } },
+    { ADDI_BNEI,    2, { ADDI, BNEI } },
+    { ADD_B,        2, { ADD, B } },
+    { MUL_B,        2, { MUL, B } },
+    { BEQI_B,       2, { BEQI, B } },
+};
+
+// Fused ops don't keep memory[PC] up to date between the instructions
+// they cover, so none of them may read or write it
+static bool touches_pc(Op *op)
+{
+    return reads_pc(op) || writes_pc(op);
+}
+
+// Rewrite frequent sequences into fused ops. Every op keeps its own
+// slot, fusing ops[i] only changes how ops[i] is dispatched, so the
+// branch targets and the PC seen by DUMP and loop_dbg are unchanged
+void code_fuse(Code *code, const void **handlers)
+{
+    memset(code->fused, 0, sizeof(code->fused));
+
+    // Going forward each op is matched against the plain decoding of
+    // the ones that follow it, which are fused only afterwards
+    for (size_t i = 0; i < code->size; i++) {
+        Op *op = &code->ops[i];
+
+        for (size_t f = 0; f < sizeof(fusions) / sizeof(fusions[0]); f++) {
+            const Fusion *fusion = &fusions[f];
+            if (i + fusion->len > code->size)
+                continue;
+
+            bool match = true;
+            for (size_t j = 0; j < fusion->len && match; j++) {
+                Op *part = &op[j];
+                match = part->code == fusion->parts[j] && !touches_pc(part);
+            }
+
+            if (match) {
+                op->code = fusion->code;
+                op->len = fusion->len;
+                op->handler = handlers ? handlers[op->code] : NULL;
+                code->fused[fusion->code - OPCODE_COUNT]++;
+                break;
+            }
+        }
+    }
+}
+
+// Size the basic blocks flagged by mark_leaders() and send their first
+// op through BLOCK_ENTRY, the interpreter accounts for a whole block
+// there and runs the ops inside it without any checks
+void code_blocks(Code *code, const void **handlers)
+{
+    for (size_t i = 0; i < code->size; i++) {
+        Op *op = &code->ops[i];
+        if (!op->block)
+            continue;
+
+        op->block = code_block_left(code, i);
+        if (handlers)
+            op->handler = handlers[BLOCK_ENTRY];
+        code->cfg[CFG_BLOCKS]++;
+    }
+}
+
+// Instructions run from ops[pc] until an op starting a block is
+// dispatched. That is the end of its basic block, or a bit further when
+// a fused op covers the start of the next one
+uint32_t code_block_left(Code *code, size_t pc)
+{
+    size_t end = pc + code->ops[pc].len;
+    while (end < code->size && !code->ops[end].block)
+        end += code->ops[end].len;
+
+    return (uint32_t)(end - pc);
+}
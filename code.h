@@ -0,0 +1,79 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include "program.h"
+#include "vm.h"
+
+// Internal opcodes produced by code_fuse(), never sent over the wire.
+// A fused op executes len adjacent instructions in one dispatch and
+// leaves PC after the last one unless one of them branches
+typedef enum {
+    MOV_SUBI = OPCODE_COUNT,
+    MOV_MOV,
+    SUBI_BEQI,
+    SUBI_BNEI,
+    ADDI_BNEI,
+    ADD_B,
+    MUL_B,
+    BEQI_B,
+    ADD_MOV_MOV,
+    MOV_MOV_BEQI,
+    FUSED_END
+} FusedOpCode;
+
+#define FUSED_COUNT (FUSED_END - OPCODE_COUNT)
+
+// Dispatch slots that aren't instructions: the first op of every basic
+// block is routed through BLOCK_ENTRY, which does the accounting for the
+// whole block, and a CODE_END op past the last one ends the program
+enum {
+    BLOCK_ENTRY = FUSED_END,
+    CODE_END,
+    DISPATCH_END
+};
+
+typedef enum {
+    CFG_BLOCKS, // basic blocks
+    CFG_BACK_EDGES, // branches to themselves or an earlier instruction
+    CFG_EXITS, // blocks that may leave the program
+    CFG_STAT_COUNT
+} CfgStat;
+
+// Pre-decoded instruction, the static operands have already been
+// checked by code_verify() so the interpreter only has to check the
+// addresses it computes at runtime (SP relative accesses, divisors)
+typedef struct {
+    const void *handler; // dispatch target, NULL for the switch engine
+    uint32_t code; // enum OpCode or FusedOpCode
+    uint32_t len; // number of instructions executed by this op
+    int32_t dest;
+    int32_t arg1;
+    int32_t arg2;
+    uint32_t block; // instructions run when starting a block, 0 inside one
+} Op;
+
+// Verified and pre-decoded form of a Program, ops[i] is the
+// decoded form of program->items[i] so PC indexes both. A fused
+// op reads the operands of the instructions it covers from the
+// ops that follow it, which keep their own decoding so branches
+// into the middle of a fused sequence still work. ops[size] is the
+// CODE_END op
+struct Code {
+    Op *ops;
+    size_t capacity;
+    size_t size;
+    uint32_t fused[FUSED_COUNT]; // how many times each fusion fired
+    uint32_t cfg[CFG_STAT_COUNT]; // shape of the control-flow graph
+};
+
+bool code_init(Code *code);
+bool code_deinit(Code *code);
+InstResult code_verify_inst(Instruction *inst, uint32_t memory_size);
+InstResult code_verify(Program *program, uint32_t memory_size, size_t *index);
+InstResult code_build(Code *code, Program *program, uint32_t memory_size,
+        const void **handlers, size_t *index);
+void code_fuse(Code *code, const void **handlers);
+void code_blocks(Code *code, const void **handlers);
+uint32_t code_block_left(Code *code, size_t pc);
+
+#endif
@@ -1,10 +1,21 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
 
 #include "el.h"
+#include "utils.h"
 
-bool el_init(EventLoop *el)
+// The first word of a free slab object links the free list, the VM
+// after it is left set up and recycled by the next connection
+typedef struct {
+    void *link;
+    Vm vm;
+} VmSlot;
+
+bool el_init(EventLoop *el, bool huge)
 {
     size_t size = 4;
     el->size = size;
@@ -14,6 +25,27 @@ bool el_init(EventLoop *el)
         return false;
     }
 
+    el->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (el->epfd < 0) {
+        printf("Failed to create epoll instance\n");
+        return false;
+    }
+
+    el->run_head = NULL;
+    el->run_tail = NULL;
+    el->runnable = 0;
+    el->polled = true;
+    el->done = NULL;
+    slab_init(&el->slabs[EL_SLAB_CONN], sizeof(Conn), huge);
+    slab_init(&el->slabs[EL_SLAB_VM], sizeof(VmSlot), huge);
+    slab_init(&el->slabs[EL_SLAB_BUF], BUF_SIZE, huge);
+
+    el->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (el->wakefd < 0) {
+        printf("Failed to create eventfd\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -29,7 +61,7 @@ bool el_resize(EventLoop *el, size_t size_new)
 
     if (size_new > size_old) {
         size_t diff = (size_new - size_old) * sizeof(Conn *);
-        memset(el->conn, 0, diff);
+        memset(el->conn + size_old, 0, diff);
     }
 
     return true;
@@ -37,11 +69,12 @@ bool el_resize(EventLoop *el, size_t size_new)
 
 bool el_add(EventLoop *el, int fd)
 {
-    if (fd >= el->size) {
-        el_resize(el, fd+1);
+    if (fd >= el->size && !el_resize(el, MAX((size_t)fd + 1, el->size * 2))) {
+        return false;
     }
 
-    Conn *conn = (Conn *)malloc(sizeof(Conn));
+    bool fresh;
+    Conn *conn = (Conn *)slab_alloc(&el->slabs[EL_SLAB_CONN], &fresh);
     if (!conn) {
         printf("Failed to allocate connection event\n");
         return false;
@@ -49,24 +82,52 @@ bool el_add(EventLoop *el, int fd)
 
     conn->fd = fd;
     conn->state = CONN_REQ;
+    conn->rbuf = NULL;
+    conn->wbuf = NULL;
+    conn->wbuf_tail = NULL;
+    conn->version = 1;
+    conn->stream = NULL;
+    conn->stream_left = 0;
+    conn->upload_more = false;
+    conn->job = NULL;
+    conn->notify = false;
+    conn->vm = NULL;
+    conn->rbuf_head = 0;
     conn->rbuf_size = 0;
     conn->wbuf_size = 0;
     conn->wbuf_sent = 0;
-
-    Vm *vm = (Vm *)malloc(sizeof(Vm));
-    vm_init(vm);
-    conn->vm = vm;
+    conn->ready = 0;
+    conn->next = NULL;
+    conn->events = 0;
+    conn->inflight = false;
+    conn->owner = el;
 
     el->conn[fd] = conn;
 
-    return true;
+    return el_update(el, conn);
 }
 
 bool el_remove(EventLoop *el, int fd)
 {
+    // Closing drops the registration
     close(fd);
-    vm_deinit(el->conn[fd]->vm);
-    free(el->conn[fd]->vm);
+
+    Conn *conn = el->conn[fd];
+    conn->rbuf_size = 0;
+    conn_wbuf_drop(conn, conn->wbuf_size);
+    conn_release(conn);
+    if (conn->job) {
+        conn_buf_free(conn, conn->job);
+    }
+    if (conn->vm) {
+        vm_unbind(conn->vm);
+
+        // Memory granted by SETUP isn't kept for whoever gets the slot
+        if (vm_memory_size(conn->vm) != MEMORY_SIZE)
+            vm_resize(conn->vm, MEMORY_SIZE);
+        slab_free(&el->slabs[EL_SLAB_VM], (uint8_t *)conn->vm - offsetof(VmSlot, vm));
+    }
+    slab_free(&el->slabs[EL_SLAB_CONN], conn);
     el->conn[fd] = NULL;
     return true;
 }
@@ -80,31 +141,337 @@ Conn *el_get(EventLoop *el, int fd)
     }
 }
 
-bool el_get_pa(EventLoop *el, struct pollfd *pa, size_t *pa_size)
+// Listen for new connections on fd, its events are reported with
+// data.fd set to it like the connections
+bool el_watch(EventLoop *el, int fd)
 {
-    size_t pos = 1;
-    for (size_t fd = 0; fd < el->size; fd++) {
-        Conn *conn = el->conn[fd];
-        if (!conn) {
-            continue;
-        }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        printf("Failed to watch fd %d\n", fd);
+        return false;
+    }
+
+    return true;
+}
+
+// Follow a change of conn->state, epoll is only told when the event
+// the connection waits for changes. Nothing to do without epoll
+bool el_update(EventLoop *el, Conn *conn)
+{
+    if (!el->polled) {
+        return true;
+    }
+
+    // Responses left over are sent once the socket has room
+    uint32_t events = 0;
+    if (conn->state == CONN_REQ) {
+        events = conn->wbuf_size ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    } else if (conn->state == CONN_RES) {
+        events = EPOLLOUT;
+    }
+
+    if (events == conn->events) {
+        return true;
+    }
+
+    int op = EPOLL_CTL_MOD;
+    if (!conn->events) {
+        op = EPOLL_CTL_ADD;
+    } else if (!events) {
+        op = EPOLL_CTL_DEL;
+    }
+
+    struct epoll_event ev = { .events = events, .data.fd = conn->fd };
+    if (epoll_ctl(el->epfd, op, conn->fd, &ev) < 0) {
+        printf("Failed to update events of fd %d\n", conn->fd);
+        return false;
+    }
+    conn->events = events;
+
+    return true;
+}
+
+// Wait up to timeout ms (-1 blocks) and return how many entries of
+// el->events are ready
+int el_wait(EventLoop *el, int timeout)
+{
+    int ready;
+    do {
+        ready = epoll_wait(el->epfd, el->events, EL_EVENTS, timeout);
+    } while (ready < 0 && errno == EINTR);
+
+    return ready;
+}
+
+void el_run_push(EventLoop *el, Conn *conn)
+{
+    conn->next = NULL;
+    if (el->run_tail) {
+        el->run_tail->next = conn;
+    } else {
+        el->run_head = conn;
+    }
+    el->run_tail = conn;
+    el->runnable++;
+}
+
+Conn *el_run_pop(EventLoop *el)
+{
+    Conn *conn = el->run_head;
+    if (!conn) {
+        return NULL;
+    }
+
+    el->run_head = conn->next;
+    if (!el->run_head) {
+        el->run_tail = NULL;
+    }
+    conn->next = NULL;
+    el->runnable--;
+
+    return conn;
+}
+
+// Give back a connection whose VM is done, from any thread. The list
+// is a lock free stack, the event loop is only woken up by the push
+// that finds it empty
+void el_done(EventLoop *el, Conn *conn)
+{
+    Conn *head = __atomic_load_n(&el->done, __ATOMIC_RELAXED);
+    do {
+        conn->next = head;
+    } while (!__atomic_compare_exchange_n(&el->done, &head, conn, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (!head) {
+        uint64_t one = 1;
+        if (write(el->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            printf("Failed to wake up event loop\n");
+    }
+}
+
+// Everything el_done() gave back so far, oldest first and linked by
+// next. Done on the event loop after wakefd was signalled
+Conn *el_take_done(EventLoop *el)
+{
+    uint64_t count;
+    if (read(el->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        printf("Failed to read eventfd\n");
+
+    Conn *conn = __atomic_exchange_n(&el->done, NULL, __ATOMIC_ACQUIRE);
+    Conn *prev = NULL;
+    while (conn) {
+        Conn *next = conn->next;
+        conn->next = prev;
+        prev = conn;
+        conn = next;
+    }
+
+    return prev;
+}
 
-        if (pos < MAX_CONN) {
-            struct pollfd pfd = {0};
-            pfd.fd = fd;
-            pfd.events = conn->state == CONN_REQ ? POLLIN : POLLOUT;
-            pfd.events = pfd.events | POLLERR;
-            pa[pos++] = pfd;
-        } else {
-            printf("Event loop is not able to handle this number of clients\n");
-            el_remove(el, fd);
+// A buffer of BUF_SIZE bytes for conn, NULL if it can't be allocated
+void *conn_buf(Conn *conn)
+{
+    bool fresh;
+    void *buf = slab_alloc(&conn->owner->slabs[EL_SLAB_BUF], &fresh);
+    if (!buf) {
+        printf("Failed to allocate connection buffer\n");
+    }
+    return buf;
+}
+
+void conn_buf_free(Conn *conn, void *buf)
+{
+    slab_free(&conn->owner->slabs[EL_SLAB_BUF], buf);
+}
+
+// Make sure rbuf is there before reading into it
+bool conn_rbuf(Conn *conn)
+{
+    if (!conn->rbuf) {
+        conn->rbuf = (uint8_t *)conn_buf(conn);
+    }
+    return conn->rbuf != NULL;
+}
+
+// The free part of rbuf as up to two ranges, the one up to the end of
+// the buffer and the one wrapped around to its start. Returns how many
+// of iov are used, so that a single readv() fills all of it
+int conn_rbuf_space(Conn *conn, struct iovec *iov)
+{
+    size_t free = BUF_SIZE - conn->rbuf_size;
+    size_t tail = (conn->rbuf_head + conn->rbuf_size) & (BUF_SIZE - 1);
+    size_t first = MIN(free, BUF_SIZE - tail);
+
+    int count = 0;
+    if (first) {
+        iov[count++] = (struct iovec) { conn->rbuf + tail, first };
+    }
+    if (free > first) {
+        iov[count++] = (struct iovec) { conn->rbuf, free - first };
+    }
+    return count;
+}
+
+// Append n bytes received elsewhere, no more than there is room for
+void conn_rbuf_fill(Conn *conn, const uint8_t *data, size_t n)
+{
+    struct iovec iov[2];
+    int count = conn_rbuf_space(conn, iov);
+    for (int i = 0; i < count && n; i++) {
+        size_t len = MIN(n, iov[i].iov_len);
+        memcpy(iov[i].iov_base, data, len);
+        conn->rbuf_size += len;
+        data += len;
+        n -= len;
+    }
+}
+
+// Copy the first n bytes out, for what wraps around the end
+void conn_rbuf_peek(Conn *conn, void *dst, size_t n)
+{
+    size_t first = MIN(n, BUF_SIZE - conn->rbuf_head);
+    memcpy(dst, conn->rbuf + conn->rbuf_head, first);
+    memcpy((uint8_t *)dst + first, conn->rbuf, n - first);
+}
+
+// Consume the first n bytes
+void conn_rbuf_drop(Conn *conn, size_t n)
+{
+    conn->rbuf_head = (conn->rbuf_head + n) & (BUF_SIZE - 1);
+    conn->rbuf_size -= n;
+}
+
+// Room for n bytes at the end of wbuf, in a new chunk if the last one
+// is too full. NULL if that can't be allocated. Nothing is queued until
+// conn_wbuf_commit(), so a response is built where it is sent from
+void *conn_wbuf_reserve(Conn *conn, size_t n)
+{
+    Chunk *tail = conn->wbuf_tail;
+    if (tail && sizeof(tail->data) - tail->size >= n) {
+        return tail->data + tail->size;
+    }
+
+    Chunk *chunk = (Chunk *)conn_buf(conn);
+    if (!chunk) {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = 0;
+    if (tail) {
+        tail->next = chunk;
+    } else {
+        conn->wbuf = chunk;
+        conn->wbuf_sent = 0;
+    }
+    conn->wbuf_tail = chunk;
+    return chunk->data;
+}
+
+// Queue the first n bytes of the last reservation
+void conn_wbuf_commit(Conn *conn, size_t n)
+{
+    conn->wbuf_tail->size += n;
+    conn->wbuf_size += n;
+}
+
+// Queue n bytes, spread over as many chunks as it takes. For responses
+// too large to be built in a reservation
+bool conn_wbuf_write(Conn *conn, const void *data, size_t n)
+{
+    const uint8_t *src = (const uint8_t *)data;
+    while (n) {
+        Chunk *tail = conn->wbuf_tail;
+        if (!tail || tail->size == sizeof(tail->data)) {
+            if (!conn_wbuf_reserve(conn, sizeof(tail->data))) {
+                return false;
+            }
+            tail = conn->wbuf_tail;
         }
+
+        size_t len = MIN(n, sizeof(tail->data) - tail->size);
+        memcpy(tail->data + tail->size, src, len);
+        conn_wbuf_commit(conn, len);
+        src += len;
+        n -= len;
     }
-    *pa_size = pos;
 
     return true;
 }
 
+// What is left to send as up to max ranges, one per chunk. Returns how
+// many of iov are used
+int conn_wbuf_iov(Conn *conn, struct iovec *iov, int max)
+{
+    int count = 0;
+    size_t sent = conn->wbuf_sent;
+    for (Chunk *chunk = conn->wbuf; chunk && count < max; chunk = chunk->next) {
+        if (chunk->size > sent) {
+            iov[count++] = (struct iovec) { chunk->data + sent, chunk->size - sent };
+        }
+        sent = 0;
+    }
+    return count;
+}
+
+// Consume n bytes sent, the chunks sent entirely go back to the slab
+void conn_wbuf_drop(Conn *conn, size_t n)
+{
+    Slab *bufs = &conn->owner->slabs[EL_SLAB_BUF];
+    conn->wbuf_size -= n;
+    n += conn->wbuf_sent;
+
+    Chunk *chunk = conn->wbuf;
+    while (chunk && (n >= chunk->size || !conn->wbuf_size)) {
+        Chunk *next = chunk->next;
+        n -= MIN(n, chunk->size);
+        slab_free(bufs, chunk);
+        chunk = next;
+    }
+
+    conn->wbuf = chunk;
+    conn->wbuf_sent = n;
+    if (!chunk) {
+        conn->wbuf_tail = NULL;
+    }
+}
+
+// Give back rbuf once it is empty, the chunks of wbuf are given back
+// as they are sent
+void conn_release(Conn *conn)
+{
+    if (conn->rbuf && !conn->rbuf_size) {
+        slab_free(&conn->owner->slabs[EL_SLAB_BUF], conn->rbuf);
+        conn->rbuf = NULL;
+        conn->rbuf_head = 0;
+    }
+}
+
+// The VM of conn, set up on first use. NULL if that failed
+Vm *conn_vm(Conn *conn)
+{
+    if (conn->vm) {
+        return conn->vm;
+    }
+
+    bool fresh;
+    VmSlot *slot = (VmSlot *)slab_alloc(&conn->owner->slabs[EL_SLAB_VM], &fresh);
+    if (!slot) {
+        printf("Failed to allocate VM\n");
+        return NULL;
+    }
+
+    if (fresh) {
+        vm_init(&slot->vm);
+    } else {
+        vm_recycle(&slot->vm);
+    }
+    conn->vm = &slot->vm;
+    return conn->vm;
+}
+
 void conn_print(Conn *conn)
 {
     printf("(fd: %d state: %d) ", conn->fd, conn->state);
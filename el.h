@@ -3,9 +3,11 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include "vm.h"
+#include "slab.h"
 
 typedef enum {
     CONN_REQ, // Should receive request
@@ -14,34 +16,117 @@ typedef enum {
     CONN_LOOP, // Should keep executing
 } ConnState;
 
-#define BUF_SIZE 512
+#define BUF_SIZE 512 // a power of two, rbuf wraps around with a mask
 
-typedef struct {
+_Static_assert((BUF_SIZE & (BUF_SIZE - 1)) == 0, "BUF_SIZE should be a power of two");
+
+// Piece of the output queue of a connection, a BUF_SIZE object of the
+// same slab as rbuf
+typedef struct Chunk {
+    struct Chunk *next;
+    size_t size;
+    uint8_t data[BUF_SIZE - sizeof(struct Chunk *) - sizeof(size_t)];
+} Chunk;
+
+_Static_assert(sizeof(Chunk) == BUF_SIZE, "Chunk should fill a buffer");
+
+// Queued output past which no more requests are parsed, until the
+// client reads what is there
+#define WBUF_MAX (4 * BUF_SIZE)
+#define WBUF_IOV 8 // chunks sent at once, more than a full queue has
+
+// A connection starts out as this handle alone. Its buffers are only
+// held while there is something in them, and its VM is set up by the
+// first request that needs one, see conn_vm(). rbuf is a ring, the
+// requests are parsed where they were received and the bytes after
+// them are left in place. wbuf queues the responses in chunks until
+// they are sent together
+typedef struct Conn {
     int fd;
     ConnState state;
-    uint8_t rbuf[BUF_SIZE];
+    uint8_t *rbuf; // NULL while empty
+    size_t rbuf_head; // first byte not parsed yet
     size_t rbuf_size;
-    uint8_t wbuf[BUF_SIZE];
-    size_t wbuf_sent;
-    size_t wbuf_size;
-    Vm *vm;
+    Chunk *wbuf; // first chunk, NULL while empty
+    Chunk *wbuf_tail; // appended to
+    size_t wbuf_sent; // of the first chunk
+    size_t wbuf_size; // queued and not sent yet
+    uint8_t version; // framing agreed on, see HELLO in server.h
+    uint8_t *stream; // receives the payload of a large frame instead of rbuf
+    size_t stream_left; // bytes of it still to come
+    bool upload_more; // the MERGE frame is followed by another
+    uint32_t upload_base; // program size before the upload
+    uint32_t upload_index; // first instruction rejected, see upload_why
+    uint32_t upload_why; // InstResult of the upload so far
+    void *job; // RUN waiting for its VM, see server.c
+    bool notify; // told when the VM of an EXEC stops, see NOTIFY
+    Vm *vm; // NULL until needed
+    uint64_t ready; // when the VM last became runnable, see sched_now()
+    uint64_t started; // when the VM was started
+    uint32_t slices; // run since then
+    LoopResult result; // of the last slice
+    struct Conn *next; // in the run queue
+    uint32_t events; // registered with epoll, 0 if not registered
+    bool inflight; // an io_uring receive or send is pending
+    struct EventLoop *owner; // serving the connection, see el_done()
 } Conn;
 
-// EventLoop is used as a map from fd to Conn
-typedef struct {
+// Slabs of an event loop
+typedef enum {
+    EL_SLAB_CONN,
+    EL_SLAB_VM,
+    EL_SLAB_BUF,
+    EL_SLAB_COUNT
+} ElSlab;
+
+// Most events handled per el_wait()
+#define EL_EVENTS 1024
+
+// EventLoop is used as a map from fd to Conn. Readiness comes from
+// epoll, a connection is registered for the one event its state waits
+// for. The connections in CONN_LOOP aren't registered at all, they wait
+// in a FIFO run queue instead, or run on the executors of pool.h and
+// come back through el_done()
+typedef struct EventLoop {
     size_t size;
     Conn **conn;
+    int epfd;
+    struct epoll_event events[EL_EVENTS]; // filled by el_wait()
+    Conn *run_head; // runs next
+    Conn *run_tail;
+    size_t runnable; // length of the run queue
+    bool polled; // connections are registered with epoll, not with io_uring
+    Conn *done; // finished on an executor, pushed by el_done()
+    Slab slabs[EL_SLAB_COUNT];
+    int wakefd; // eventfd signalled when done stops being empty
 } EventLoop;
 
-#define MAX_CONN 10000
-
-bool el_init(EventLoop *el);
+bool el_init(EventLoop *el, bool huge);
 bool el_resize(EventLoop *el, size_t size_new);
 bool el_add(EventLoop *el, int fd);
 bool el_remove(EventLoop *el, int fd);
 Conn *el_get(EventLoop *el, int fd);
-bool pa_init(struct pollfd *pa);
-bool el_get_pa(EventLoop *el, struct pollfd *pa, size_t *pa_size);
+bool el_watch(EventLoop *el, int fd);
+bool el_update(EventLoop *el, Conn *conn);
+int el_wait(EventLoop *el, int timeout);
+void el_run_push(EventLoop *el, Conn *conn);
+Conn *el_run_pop(EventLoop *el);
+void el_done(EventLoop *el, Conn *conn);
+Conn *el_take_done(EventLoop *el);
+void *conn_buf(Conn *conn);
+void conn_buf_free(Conn *conn, void *buf);
+bool conn_rbuf(Conn *conn);
+int conn_rbuf_space(Conn *conn, struct iovec *iov);
+void conn_rbuf_fill(Conn *conn, const uint8_t *data, size_t n);
+void conn_rbuf_peek(Conn *conn, void *dst, size_t n);
+void conn_rbuf_drop(Conn *conn, size_t n);
+void *conn_wbuf_reserve(Conn *conn, size_t n);
+void conn_wbuf_commit(Conn *conn, size_t n);
+bool conn_wbuf_write(Conn *conn, const void *data, size_t n);
+int conn_wbuf_iov(Conn *conn, struct iovec *iov, int max);
+void conn_wbuf_drop(Conn *conn, size_t n);
+void conn_release(Conn *conn);
+Vm *conn_vm(Conn *conn);
 void conn_print(Conn *conn);
 void el_print(EventLoop *el);
 
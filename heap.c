@@ -0,0 +1,92 @@
+#include <string.h>
+
+#include "heap.h"
+
+void heap_init(Heap *heap, int32_t base, int32_t end)
+{
+    memset(heap, 0, sizeof(*heap));
+    heap->base = base;
+    heap->end = end;
+    heap->top = base;
+}
+
+static int32_t heap_class(int32_t size)
+{
+    if (size <= 1)
+        return 0;
+    return 32 - __builtin_clz((uint32_t)size - 1);
+}
+
+// Guest code can write anywhere in the heap, so a block header is only
+// trusted if it sits in the carved out part and has the expected tag
+static bool heap_check(Heap *heap, int32_t *memory, int32_t addr, int32_t header)
+{
+    if (addr <= heap->base || addr >= heap->top)
+        return false;
+    if (memory[addr - 1] != header)
+        return false;
+    return addr + (1 << (header & HEAP_CLASS_MASK)) <= heap->top;
+}
+
+// Address of a block of at least size words, 0 if there is no room
+int32_t heap_alloc(Heap *heap, int32_t *memory, int32_t size)
+{
+    int32_t c = heap_class(size);
+    if (size <= 0 || c >= HEAP_CLASSES) {
+        heap->stats[HEAP_FAILURES]++;
+        return 0;
+    }
+
+    int32_t words = 1 << c;
+    int32_t addr = heap->free[c];
+    if (addr && heap_check(heap, memory, addr, HEAP_TAG | c)) {
+        // The link lives in the first word of the free block
+        heap->free[c] = memory[addr];
+        heap->stats[HEAP_REUSED]++;
+    } else {
+        // A corrupted list is dropped rather than followed
+        heap->free[c] = 0;
+        if (words + 1 > heap->end - heap->top) {
+            heap->stats[HEAP_FAILURES]++;
+            return 0;
+        }
+        addr = heap->top + 1;
+        heap->top += words + 1;
+        heap->stats[HEAP_TOP_WORDS] = heap->top - heap->base;
+    }
+
+    memory[addr - 1] = HEAP_TAG | HEAP_LIVE | c;
+    heap->stats[HEAP_ALLOCS]++;
+    heap->stats[HEAP_LIVE_BLOCKS]++;
+    heap->stats[HEAP_LIVE_WORDS] += words;
+    if (heap->stats[HEAP_LIVE_WORDS] > heap->stats[HEAP_PEAK_WORDS])
+        heap->stats[HEAP_PEAK_WORDS] = heap->stats[HEAP_LIVE_WORDS];
+
+    return addr;
+}
+
+// Freeing 0 does nothing, false if addr is not a live block
+bool heap_free(Heap *heap, int32_t *memory, int32_t addr)
+{
+    if (addr == 0)
+        return true;
+
+    if (addr <= heap->base || addr >= heap->top)
+        return false;
+
+    int32_t header = memory[addr - 1];
+    int32_t c = header & HEAP_CLASS_MASK;
+    if ((header & ~HEAP_CLASS_MASK) != (HEAP_TAG | HEAP_LIVE) || c >= HEAP_CLASSES
+        || !heap_check(heap, memory, addr, header))
+        return false;
+
+    memory[addr - 1] = HEAP_TAG | c;
+    memory[addr] = heap->free[c];
+    heap->free[c] = addr;
+
+    heap->stats[HEAP_FREES]++;
+    heap->stats[HEAP_LIVE_BLOCKS]--;
+    heap->stats[HEAP_LIVE_WORDS] -= 1 << c;
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Blocks come in power of two size classes, class c holds 1 << c words
+#define HEAP_CLASSES 24
+
+// Header word stored before every block with its class in the low bits
+#define HEAP_TAG 0x48500000
+#define HEAP_LIVE 0x100
+#define HEAP_CLASS_MASK 0xff
+
+// Counters read by DUMP with the DUMP_HEAP section
+typedef enum {
+    HEAP_ALLOCS,
+    HEAP_FREES,
+    HEAP_FAILURES, // allocations that returned 0
+    HEAP_REUSED, // allocations served from a free list
+    HEAP_LIVE_BLOCKS,
+    HEAP_LIVE_WORDS, // rounded up to the size class
+    HEAP_PEAK_WORDS,
+    HEAP_TOP_WORDS, // words ever carved out, headers included
+    HEAP_STAT_COUNT
+} HeapStat;
+
+// Segregated free list allocator over memory[base, end). Freed blocks
+// go back to the list of their class and are never split or merged,
+// so both allocating and freeing are O(1). Address 0 is never a block
+// and stands for a failed allocation
+typedef struct {
+    int32_t base;
+    int32_t end;
+    int32_t top; // first word not carved out yet
+    int32_t free[HEAP_CLASSES]; // first free block of each class, 0 if none
+    uint32_t stats[HEAP_STAT_COUNT];
+} Heap;
+
+void heap_init(Heap *heap, int32_t base, int32_t end);
+int32_t heap_alloc(Heap *heap, int32_t *memory, int32_t size);
+bool heap_free(Heap *heap, int32_t *memory, int32_t addr);
+
+#endif
@@ -0,0 +1,696 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+// Arguments of the generated function, passed in rdi
+typedef struct {
+    int32_t *memory;
+    const void *entry;
+    int32_t budget; // instructions left before preempting at a back-edge
+    uint32_t pc;
+    uint32_t status; // enum JitResult
+} JitFrame;
+
+typedef void (*JitFn)(JitFrame *frame);
+
+// Host registers. While guest code runs rbp holds the guest memory,
+// esi the budget, rdi the frame and eax/ecx/edx are scratch
+enum {
+    HOST_RAX, HOST_RCX, HOST_RDX, HOST_RBX,
+    HOST_RSP, HOST_RBP, HOST_RSI, HOST_RDI,
+    HOST_R8, HOST_R9, HOST_R10, HOST_R11,
+    HOST_R12, HOST_R13, HOST_R14, HOST_R15,
+};
+
+// Condition codes of jcc
+enum {
+    CC_O = 0x0,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+};
+
+// Extensions of the 0x81 group (op rm, imm32)
+enum {
+    ALU_ADD = 0,
+    ALU_SUB = 5,
+    ALU_CMP = 7,
+};
+
+typedef struct {
+    size_t at; // offset of the rel32 to patch
+    uint32_t target; // guest instruction or stub index
+} Fixup;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t status; // enum JitResult
+    uint32_t refund; // instructions of the block charged but not run
+} Stub;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    Fixup *branches; // jumps to guest instructions
+    size_t branches_size;
+    Fixup *exits; // jumps to stubs
+    Stub *stubs;
+    size_t stubs_size;
+    uint32_t memory_size; // guest memory in words
+    uint32_t block_end; // first instruction past the block being emitted
+    bool failed;
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t byte)
+{
+    if (e->size == e->capacity) {
+        size_t capacity_new = 2 * e->capacity;
+        uint8_t *data = realloc(e->data, capacity_new);
+        if (data == NULL) {
+            e->failed = true;
+            return;
+        }
+        e->data = data;
+        e->capacity = capacity_new;
+    }
+
+    e->data[e->size++] = byte;
+}
+
+static void emit32(Emitter *e, uint32_t word)
+{
+    for (size_t i = 0; i < 4; i++) {
+        emit8(e, (word >> (8 * i)) & 0xff);
+    }
+}
+
+static void emit(Emitter *e, const uint8_t *bytes, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        emit8(e, bytes[i]);
+    }
+}
+
+static void patch32(Emitter *e, size_t at, size_t dest)
+{
+    int32_t rel = (int32_t)(dest - (at + 4));
+    memcpy(&e->data[at], &rel, sizeof(rel));
+}
+
+// Host register caching a guest slot, -1 if it stays in memory
+static int slot_reg(int32_t slot)
+{
+    switch (slot) {
+    case R0: return HOST_R12;
+    case R1: return HOST_R13;
+    case R2: return HOST_R14;
+    case R3: return HOST_R15;
+    case SP: return HOST_RBX;
+    default: return -1;
+    }
+}
+
+static void emit_rex(Emitter *e, bool w, int reg, int rm)
+{
+    uint8_t rex = 0x40 | (w ? 0x08 : 0) | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0);
+    if (rex != 0x40)
+        emit8(e, rex);
+}
+
+// One byte opcodes or 0x0f escaped ones, after the REX prefix
+static void emit_op(Emitter *e, uint16_t op)
+{
+    if (op > 0xff)
+        emit8(e, op >> 8);
+    emit8(e, op & 0xff);
+}
+
+// op reg, rm with both operands in registers
+static void emit_rr(Emitter *e, uint16_t op, int reg, int rm)
+{
+    emit_rex(e, false, reg, rm);
+    emit_op(e, op);
+    emit8(e, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op reg, [base + disp32]
+static void emit_mem(Emitter *e, bool w, uint16_t op, int reg, int base, int32_t disp)
+{
+    emit_rex(e, w, reg, base);
+    emit_op(e, op);
+    emit8(e, 0x80 | (reg & 7) << 3 | (base & 7));
+    emit32(e, (uint32_t)disp);
+}
+
+// op reg, slot wherever the slot lives
+static void emit_slot(Emitter *e, uint16_t op, int reg, int32_t slot)
+{
+    int rm = slot_reg(slot);
+    if (rm >= 0)
+        emit_rr(e, op, reg, rm);
+    else
+        emit_mem(e, false, op, reg, HOST_RBP, slot * (int32_t)sizeof(int32_t));
+}
+
+static void emit_load(Emitter *e, int reg, int32_t slot)
+{
+    emit_slot(e, 0x8b, reg, slot);
+}
+
+static void emit_store(Emitter *e, int32_t slot, int reg)
+{
+    emit_slot(e, 0x89, reg, slot);
+}
+
+static void emit_mov_imm(Emitter *e, int reg, int32_t imm)
+{
+    emit_rex(e, false, 0, reg);
+    emit8(e, 0xb8 + (reg & 7));
+    emit32(e, (uint32_t)imm);
+}
+
+static void emit_store_imm(Emitter *e, int32_t slot, int32_t imm)
+{
+    int reg = slot_reg(slot);
+    if (reg >= 0) {
+        emit_mov_imm(e, reg, imm);
+    } else {
+        emit_mem(e, false, 0xc7, 0, HOST_RBP, slot * (int32_t)sizeof(int32_t));
+        emit32(e, (uint32_t)imm);
+    }
+}
+
+static void emit_alu_imm(Emitter *e, int ext, int rm, int32_t imm)
+{
+    emit_rr(e, 0x81, ext, rm);
+    emit32(e, (uint32_t)imm);
+}
+
+// lea eax, [rbx + disp32], the SP that an instruction would produce
+static void emit_sp_offset(Emitter *e, int32_t disp)
+{
+    emit_mem(e, false, 0x8d, HOST_RAX, HOST_RBX, disp);
+}
+
+// Exit through a stub, bailing out gives back the budget of the
+// instructions from pc to the end of the block, the interpreter
+// charges them when it runs them
+static void add_exit(Emitter *e, uint32_t pc, JitResult status)
+{
+    uint32_t refund = status == JIT_BAIL ? e->block_end - pc : 0;
+    e->exits[e->stubs_size] = (Fixup) { e->size, e->stubs_size };
+    e->stubs[e->stubs_size++] = (Stub) { pc, status, refund };
+    emit32(e, 0);
+}
+
+static void emit_jcc_exit(Emitter *e, int cc, uint32_t pc, JitResult status)
+{
+    emit8(e, 0x0f);
+    emit8(e, 0x80 | cc);
+    add_exit(e, pc, status);
+}
+
+static void emit_jmp_exit(Emitter *e, uint32_t pc, JitResult status)
+{
+    emit8(e, 0xe9);
+    add_exit(e, pc, status);
+}
+
+// Leave the native code before running the instruction at pc unless
+// SP + disp is in the stack, [SB, HEAP_BASE), where it doesn't alias a
+// cached register
+static void emit_guard_sp(Emitter *e, int32_t disp, uint32_t pc)
+{
+    emit_sp_offset(e, disp - SB);
+    emit_alu_imm(e, ALU_CMP, HOST_RAX, HEAP_BASE(e->memory_size) - SB);
+    emit_jcc_exit(e, CC_AE, pc, JIT_BAIL);
+}
+
+// Leave eax = memory[base] + disp - SB, exiting before the instruction at
+// pc unless the address is in memory and past the cached registers
+static void emit_guard_addr(Emitter *e, int32_t base, int32_t disp, uint32_t pc)
+{
+    if ((int64_t)disp - SB < INT32_MIN) {
+        emit_jmp_exit(e, pc, JIT_BAIL);
+        return;
+    }
+
+    emit_load(e, HOST_RAX, base);
+    emit_alu_imm(e, ALU_ADD, HOST_RAX, disp - SB);
+    emit_jcc_exit(e, CC_O, pc, JIT_BAIL);
+    emit_alu_imm(e, ALU_CMP, HOST_RAX, e->memory_size - SB);
+    emit_jcc_exit(e, CC_AE, pc, JIT_BAIL);
+}
+
+// Jump to a guest instruction, back-edges check the budget first
+static void emit_jump(Emitter *e, uint32_t target, uint32_t pc)
+{
+    if (target <= pc) {
+        emit_rr(e, 0x85, HOST_RSI, HOST_RSI);
+        emit_jcc_exit(e, CC_LE, target, JIT_PREEMPT);
+    }
+
+    emit8(e, 0xe9);
+    e->branches[e->branches_size++] = (Fixup) { e->size, target };
+    emit32(e, 0);
+}
+
+// Conditional jump on the flags that have just been set
+static void emit_branch(Emitter *e, int cc, uint32_t target, uint32_t pc)
+{
+    if (target <= pc) {
+        // Skip the budget check and the jump when not taken
+        emit8(e, 0x70 | (cc ^ 1));
+        emit8(e, 2 + 6 + 5);
+        emit_jump(e, target, pc);
+        return;
+    }
+
+    emit8(e, 0x0f);
+    emit8(e, 0x80 | cc);
+    e->branches[e->branches_size++] = (Fixup) { e->size, target };
+    emit32(e, 0);
+}
+
+static void emit_prologue(Emitter *e)
+{
+    static const uint8_t push[] = {
+        0x53,       // push rbx
+        0x55,       // push rbp
+        0x41, 0x54, // push r12
+        0x41, 0x55, // push r13
+        0x41, 0x56, // push r14
+        0x41, 0x57, // push r15
+    };
+    emit(e, push, sizeof(push));
+
+    emit_mem(e, true, 0x8b, HOST_RBP, HOST_RDI, offsetof(JitFrame, memory));
+    emit_mem(e, false, 0x8b, HOST_RSI, HOST_RDI, offsetof(JitFrame, budget));
+    for (int32_t slot = R0; slot <= SP; slot++) {
+        if (slot_reg(slot) >= 0)
+            emit_mem(e, false, 0x8b, slot_reg(slot), HOST_RBP, slot * sizeof(int32_t));
+    }
+
+    // jmp [rdi + entry]
+    emit_mem(e, false, 0xff, 4, HOST_RDI, offsetof(JitFrame, entry));
+}
+
+// Every exit lands here with the guest pc in eax and the status in ecx
+static void emit_epilogue(Emitter *e)
+{
+    for (int32_t slot = R0; slot <= SP; slot++) {
+        if (slot_reg(slot) >= 0)
+            emit_mem(e, false, 0x89, slot_reg(slot), HOST_RBP, slot * sizeof(int32_t));
+    }
+
+    emit_mem(e, false, 0x89, HOST_RSI, HOST_RDI, offsetof(JitFrame, budget));
+    emit_mem(e, false, 0x89, HOST_RAX, HOST_RDI, offsetof(JitFrame, pc));
+    emit_mem(e, false, 0x89, HOST_RCX, HOST_RDI, offsetof(JitFrame, status));
+
+    static const uint8_t pop[] = {
+        0x41, 0x5f, // pop r15
+        0x41, 0x5e, // pop r14
+        0x41, 0x5d, // pop r13
+        0x41, 0x5c, // pop r12
+        0x5d,       // pop rbp
+        0x5b,       // pop rbx
+        0xc3,       // ret
+    };
+    emit(e, pop, sizeof(pop));
+}
+
+// The native code keeps memory[PC] in no register and never updates
+// it, programs that read or write it run in the interpreter instead
+static bool uses_pc(Instruction *inst)
+{
+    switch (inst->code) {
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+        return inst->dest == PC || inst->arg1 == PC || inst->arg2 == PC;
+    case ADDI:
+    case SUBI:
+    case MULI:
+    case DIVI:
+    case MOV:
+        return inst->dest == PC || inst->arg1 == PC;
+    case HALLO:
+    case LOAD:
+    case STORE:
+        return inst->dest == PC || inst->arg1 == PC;
+    case MOVI:
+    case PUSH:
+    case POP:
+    case RET:
+    case HFREE:
+        return inst->dest == PC;
+    case BEQ:
+    case BNE:
+    case BGE:
+        return inst->arg1 == PC || inst->arg2 == PC;
+    case BEQI:
+    case BNEI:
+    case BGEI:
+        return inst->arg1 == PC;
+    case BLEI:
+        return inst->arg2 == PC;
+    default:
+        return false;
+    }
+}
+
+static bool ends_block(uint32_t code)
+{
+    switch (code) {
+    case B:
+    case BEQ:
+    case BEQI:
+    case BNE:
+    case BNEI:
+    case BGE:
+    case BGEI:
+    case BLEI:
+    case HALT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void emit_inst(Emitter *e, Instruction *inst, uint32_t pc, uint32_t size)
+{
+    int32_t dest = (int32_t)inst->dest;
+    int32_t arg1 = (int32_t)inst->arg1;
+    int32_t arg2 = (int32_t)inst->arg2;
+
+    switch (inst->code) {
+    case ADD:
+    case SUB:
+    case MUL:
+        emit_load(e, HOST_RAX, arg1);
+        if (inst->code == MUL)
+            emit_slot(e, 0x0faf, HOST_RAX, arg2);
+        else
+            emit_slot(e, inst->code == ADD ? 0x03 : 0x2b, HOST_RAX, arg2);
+        emit_store(e, dest, HOST_RAX);
+        break;
+    case ADDI:
+    case SUBI:
+        emit_load(e, HOST_RAX, arg1);
+        emit_alu_imm(e, inst->code == ADDI ? ALU_ADD : ALU_SUB, HOST_RAX, arg2);
+        emit_store(e, dest, HOST_RAX);
+        break;
+    case MULI:
+        emit_load(e, HOST_RAX, arg1);
+        emit_rr(e, 0x69, HOST_RAX, HOST_RAX);
+        emit32(e, (uint32_t)arg2);
+        emit_store(e, dest, HOST_RAX);
+        break;
+    case DIV:
+    case DIVI:
+        // Zero divisors and INT_MIN / -1 are left to the interpreter,
+        // which fails the program with the reason
+        if (inst->code == DIV) {
+            emit_load(e, HOST_RCX, arg2);
+            emit_rr(e, 0x85, HOST_RCX, HOST_RCX);
+            emit_jcc_exit(e, CC_E, pc, JIT_BAIL);
+        } else {
+            emit_mov_imm(e, HOST_RCX, arg2);
+        }
+        emit_load(e, HOST_RAX, arg1);
+        if (inst->code == DIV || arg2 == -1) {
+            emit_alu_imm(e, ALU_CMP, HOST_RAX, INT32_MIN);
+            emit_jcc_exit(e, CC_E, pc, JIT_BAIL);
+        }
+        emit8(e, 0x99); // cdq
+        emit_rr(e, 0xf7, 7, HOST_RCX); // idiv ecx
+        emit_store(e, dest, HOST_RAX);
+        break;
+    case MOV:
+        emit_load(e, HOST_RAX, arg1);
+        emit_store(e, dest, HOST_RAX);
+        break;
+    case MOVI:
+        emit_store_imm(e, dest, arg1);
+        break;
+    case PUSH:
+    case PUSHI:
+        emit_guard_sp(e, 0, pc);
+        if (inst->code == PUSH) {
+            emit_load(e, HOST_RCX, dest);
+            // mov [rbp + rbx * 4], ecx
+            emit(e, (uint8_t[]){ 0x89, 0x4c, 0x9d, 0x00 }, 4);
+        } else {
+            // mov dword [rbp + rbx * 4], imm32
+            emit(e, (uint8_t[]){ 0xc7, 0x44, 0x9d, 0x00 }, 4);
+            emit32(e, (uint32_t)dest);
+        }
+        emit_alu_imm(e, ALU_ADD, HOST_RBX, 1);
+        break;
+    case POP:
+        emit_guard_sp(e, -1, pc);
+        emit_alu_imm(e, ALU_SUB, HOST_RBX, 1);
+        // mov eax, [rbp + rbx * 4]
+        emit(e, (uint8_t[]){ 0x8b, 0x44, 0x9d, 0x00 }, 4);
+        emit_store(e, dest, HOST_RAX);
+        break;
+    case SALLO:
+    case SFREE:
+        emit_sp_offset(e, inst->code == SALLO ? dest : -dest);
+        emit_alu_imm(e, ALU_CMP, HOST_RAX, HEAP_BASE(e->memory_size));
+        emit_jcc_exit(e, CC_AE, pc, JIT_BAIL);
+        emit_rr(e, 0x89, HOST_RAX, HOST_RBX);
+        break;
+    case B:
+        emit_jump(e, dest, pc);
+        break;
+    case BEQ:
+    case BNE:
+    case BGE:
+        emit_load(e, HOST_RAX, arg1);
+        emit_slot(e, 0x3b, HOST_RAX, arg2);
+        emit_branch(e, inst->code == BEQ ? CC_E : inst->code == BNE ? CC_NE : CC_GE, dest, pc);
+        break;
+    case BEQI:
+    case BNEI:
+    case BGEI:
+        emit_load(e, HOST_RAX, arg1);
+        emit_alu_imm(e, ALU_CMP, HOST_RAX, arg2);
+        emit_branch(e, inst->code == BEQI ? CC_E : inst->code == BNEI ? CC_NE : CC_GE, dest, pc);
+        break;
+    case BLEI:
+        emit_load(e, HOST_RAX, arg2);
+        emit_alu_imm(e, ALU_CMP, HOST_RAX, arg1);
+        emit_branch(e, CC_GE, dest, pc);
+        break;
+    case RET:
+        emit_load(e, HOST_RAX, dest);
+        emit_store(e, R0, HOST_RAX);
+        break;
+    case RETI:
+        emit_store_imm(e, R0, dest);
+        break;
+    case HALT:
+        emit_jmp_exit(e, size, JIT_END);
+        break;
+    case LOAD:
+    case STORE:
+        emit_guard_addr(e, inst->code == LOAD ? arg1 : dest, arg2, pc);
+        if (inst->code == LOAD) {
+            // mov edx, [rbp + rax * 4 + SB * 4]
+            emit(e, (uint8_t[]){ 0x8b, 0x94, 0x85 }, 3);
+            emit32(e, SB * sizeof(int32_t));
+            emit_store(e, dest, HOST_RDX);
+        } else {
+            emit_load(e, HOST_RCX, arg1);
+            // mov [rbp + rax * 4 + SB * 4], ecx
+            emit(e, (uint8_t[]){ 0x89, 0x8c, 0x85 }, 3);
+            emit32(e, SB * sizeof(int32_t));
+        }
+        break;
+    case HALLO:
+    case HFREE:
+    default:
+        // The heap allocator only runs in the interpreter
+        emit_jmp_exit(e, pc, JIT_BAIL);
+        break;
+    }
+}
+
+// Translate a verified program, false if it can't be compiled
+bool jit_compile(Jit *jit, Program *program, uint32_t memory_size)
+{
+    uint32_t size = (uint32_t)program_size(program);
+    for (uint32_t i = 0; i < size; i++) {
+        if (uses_pc(program_fetch(program, i)))
+            return false;
+    }
+
+    // Instructions that start a basic block, each block charges its
+    // length to the budget on entry
+    bool *leaders = calloc(size + 1, sizeof(bool));
+    uint32_t *entries = malloc((size + 1) * sizeof(uint32_t));
+    Emitter e = {
+        .data = malloc(64 * (size + 8)),
+        .capacity = 64 * (size + 8),
+        .branches = malloc((size + 1) * sizeof(Fixup)),
+        .exits = malloc(3 * (size + 1) * sizeof(Fixup)),
+        .stubs = malloc(3 * (size + 1) * sizeof(Stub)),
+        .memory_size = memory_size,
+    };
+
+    bool rv = false;
+    if (!leaders || !entries || !e.data || !e.branches || !e.exits || !e.stubs)
+        goto out;
+
+    leaders[0] = true;
+    leaders[size] = true;
+    for (uint32_t i = 0; i < size; i++) {
+        Instruction *inst = program_fetch(program, i);
+        if (ends_block(inst->code)) {
+            leaders[i + 1] = true;
+            if (inst->code != HALT)
+                leaders[inst->dest] = true;
+        }
+    }
+
+    emit_prologue(&e);
+
+    for (uint32_t i = 0; i < size; i++) {
+        entries[i] = e.size;
+        if (leaders[i]) {
+            uint32_t end = i + 1;
+            while (!leaders[end])
+                end++;
+            emit_alu_imm(&e, ALU_SUB, HOST_RSI, end - i);
+            e.block_end = end;
+        }
+        emit_inst(&e, program_fetch(program, i), i, size);
+    }
+    entries[size] = e.size;
+    emit_jmp_exit(&e, size, JIT_END);
+
+    // Stubs refund the budget, load the exit pc and status then share
+    // the epilogue. jumps[i] is the rel32 of the jump of stub i
+    size_t *stubs = malloc(2 * (e.stubs_size + 1) * sizeof(size_t));
+    if (stubs == NULL)
+        goto out;
+    size_t *jumps = stubs + e.stubs_size + 1;
+
+    for (size_t i = 0; i < e.stubs_size; i++) {
+        stubs[i] = e.size;
+        if (e.stubs[i].refund)
+            emit_alu_imm(&e, ALU_ADD, HOST_RSI, e.stubs[i].refund);
+        emit_mov_imm(&e, HOST_RAX, e.stubs[i].pc);
+        emit_mov_imm(&e, HOST_RCX, e.stubs[i].status);
+        emit8(&e, 0xe9);
+        jumps[i] = e.size;
+        emit32(&e, 0);
+    }
+    size_t epilogue = e.size;
+    emit_epilogue(&e);
+
+    if (e.failed) {
+        free(stubs);
+        goto out;
+    }
+
+    for (size_t i = 0; i < e.stubs_size; i++) {
+        patch32(&e, e.exits[i].at, stubs[i]);
+        patch32(&e, jumps[i], epilogue);
+    }
+    free(stubs);
+
+    for (size_t i = 0; i < e.branches_size; i++) {
+        patch32(&e, e.branches[i].at, entries[e.branches[i].target]);
+    }
+
+    // Map the code writable then flip it to executable
+    size_t mapped = e.size;
+    uint8_t *code = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        fprintf(stderr, "Failed to map JIT code\n");
+        goto out;
+    }
+
+    memcpy(code, e.data, e.size);
+    if (mprotect(code, mapped, PROT_READ | PROT_EXEC) < 0) {
+        fprintf(stderr, "Failed to protect JIT code\n");
+        munmap(code, mapped);
+        goto out;
+    }
+
+    jit->code = code;
+    jit->size = mapped;
+    jit->entries = entries;
+    jit->count = size;
+    entries = NULL;
+    rv = true;
+
+out:
+    free(leaders);
+    free(entries);
+    free(e.data);
+    free(e.branches);
+    free(e.exits);
+    free(e.stubs);
+    return rv;
+}
+
+void jit_free(Jit *jit)
+{
+    if (jit->code)
+        munmap(jit->code, jit->size);
+    free(jit->entries);
+    *jit = (Jit) {0};
+}
+
+// Run from memory[PC] until the end of the program, a back-edge taken
+// with the budget exhausted or an instruction the interpreter must run.
+// executed is the budget consumed, charged a whole block at a time
+// except for the instructions left when bailing out
+JitResult jit_exec(Jit *jit, int32_t *memory, int32_t budget, int32_t *executed)
+{
+    JitFrame frame = {
+        .memory = memory,
+        .entry = jit->code + jit->entries[memory[PC]],
+        .budget = budget,
+    };
+
+    ((JitFn)jit->code)(&frame);
+
+    memory[PC] = (int32_t)frame.pc;
+    *executed = budget - frame.budget;
+    return frame.status;
+}
+
+#else
+
+bool jit_compile(Jit *jit, Program *program, uint32_t memory_size)
+{
+    return false;
+}
+
+void jit_free(Jit *jit)
+{
+}
+
+JitResult jit_exec(Jit *jit, int32_t *memory, int32_t budget, int32_t *executed)
+{
+    *executed = 0;
+    return JIT_BAIL;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "program.h"
+#include "vm.h"
+
+typedef enum {
+    JIT_END, // ran past the end of the program or halted
+    JIT_PREEMPT, // budget exhausted at a back-edge
+    JIT_BAIL, // the instruction at pc must run in the interpreter
+} JitResult;
+
+// Native x86-64 translation of a verified Program. R0-R3 and SP live in
+// host registers while the code runs and are written back on every exit
+struct Jit {
+    uint8_t *code; // executable mapping, the entry trampoline is at offset 0
+    size_t size; // size of the mapping
+    uint32_t *entries; // native offset of every guest instruction
+    size_t count; // number of guest instructions
+};
+
+bool jit_compile(Jit *jit, Program *program, uint32_t memory_size);
+void jit_free(Jit *jit);
+JitResult jit_exec(Jit *jit, int32_t *memory, int32_t budget, int32_t *executed);
+
+#endif
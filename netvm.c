@@ -1,6 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "server.h"
 
-int main()
+int main(int argc, char **argv)
 {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            server_config.jit = true;
+        } else if (strcmp(argv[i], "--memory-max") == 0 && i + 1 < argc) {
+            server_config.memory_max = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--no-uring") == 0) {
+            server_config.uring = false;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            server_config.workers = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            server_config.pin = true;
+        } else if (strcmp(argv[i], "--executors") == 0 && i + 1 < argc) {
+            server_config.executors = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--accept-batch") == 0 && i + 1 < argc) {
+            server_config.accept_batch = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            server_config.cache_size = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            server_config.hugepages = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--jit] [--memory-max WORDS] [--no-uring] [--workers N] [--pin] [--executors N] [--hugepages] [--accept-batch N] [--cache-size INSTRUCTIONS]\n", argv[0]);
+            return 1;
+        }
+    }
+
     start_server(8080);
 }
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pool.h"
+
+static bool deque_init(Deque *deque)
+{
+    deque->capacity = 16;
+    deque->conns = (Conn **)malloc(deque->capacity * sizeof(Conn *));
+    if (!deque->conns)
+        return false;
+
+    deque->head = 0;
+    deque->size = 0;
+    return pthread_mutex_init(&deque->lock, NULL) == 0;
+}
+
+// Called with the lock held
+static bool deque_grow(Deque *deque)
+{
+    size_t capacity = deque->capacity * 2;
+    Conn **conns = (Conn **)malloc(capacity * sizeof(Conn *));
+    if (!conns)
+        return false;
+
+    for (size_t i = 0; i < deque->size; i++) {
+        conns[i] = deque->conns[(deque->head + i) % deque->capacity];
+    }
+    free(deque->conns);
+    deque->conns = conns;
+    deque->capacity = capacity;
+    deque->head = 0;
+    return true;
+}
+
+static bool deque_push(Deque *deque, Conn *conn)
+{
+    pthread_mutex_lock(&deque->lock);
+    bool ok = deque->size < deque->capacity || deque_grow(deque);
+    if (ok) {
+        deque->conns[(deque->head + deque->size) % deque->capacity] = conn;
+        __atomic_store_n(&deque->size, deque->size + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return ok;
+}
+
+static Conn *deque_pop(Deque *deque, bool front)
+{
+    // Skip the lock for the empty deques a thief looks at
+    if (!__atomic_load_n(&deque->size, __ATOMIC_RELAXED))
+        return NULL;
+
+    Conn *conn = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->size) {
+        size_t at = front ? deque->head : deque->head + deque->size - 1;
+        conn = deque->conns[at % deque->capacity];
+        if (front)
+            deque->head = (deque->head + 1) % deque->capacity;
+        __atomic_store_n(&deque->size, deque->size - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return conn;
+}
+
+static bool pool_push(Pool *pool, Deque *deque, Conn *conn)
+{
+    if (!deque_push(deque, conn)) {
+        printf("Failed to queue VM\n");
+        return false;
+    }
+
+    // Either the sleeper sees queued or we see the sleeper
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return true;
+}
+
+// Own work first, then the other deques starting with the next one
+static Conn *pool_take(Executor *ex)
+{
+    Pool *pool = ex->pool;
+    Conn *conn = deque_pop(&ex->deque, true);
+    for (uint32_t i = 1; !conn && i < pool->size; i++) {
+        conn = deque_pop(&pool->executors[(ex->id + i) % pool->size].deque, false);
+    }
+
+    if (conn)
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    return conn;
+}
+
+static void pool_sleep(Pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *executor_main(void *arg)
+{
+    Executor *ex = (Executor *)arg;
+    Pool *pool = ex->pool;
+    pool->init();
+
+    while (1) {
+        Conn *conn = pool_take(ex);
+        if (!conn) {
+            pool_sleep(pool);
+            continue;
+        }
+
+        size_t runnable = __atomic_load_n(&ex->deque.size, __ATOMIC_RELAXED) + 1;
+        if (!pool->run(conn, runnable)) {
+            el_done(conn->owner, conn);
+        } else if (!pool_push(pool, &ex->deque, conn)) {
+            // It can't be queued again, it stops here
+            conn->result = LR_ABORTED;
+            el_done(conn->owner, conn);
+        }
+    }
+
+    return NULL;
+}
+
+bool pool_init(Pool *pool, uint32_t size, void (*init)(void),
+        bool (*run)(Conn *conn, size_t runnable))
+{
+    pool->size = size;
+    pool->next = 0;
+    pool->queued = 0;
+    pool->sleeping = 0;
+    pool->init = init;
+    pool->run = run;
+    if (pthread_mutex_init(&pool->lock, NULL) != 0
+        || pthread_cond_init(&pool->wake, NULL) != 0) {
+        printf("Failed to set up executor pool\n");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        Executor *ex = &pool->executors[i];
+        ex->pool = pool;
+        ex->id = i;
+        if (!deque_init(&ex->deque)) {
+            printf("Failed to allocate executor deque\n");
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        Executor *ex = &pool->executors[i];
+        if (pthread_create(&ex->thread, NULL, executor_main, ex) != 0) {
+            printf("Failed to start executor\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Hand a VM in CONN_LOOP over to the executors, from an event loop.
+// False if it could not be queued
+bool pool_submit(Pool *pool, Conn *conn)
+{
+    uint32_t next = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    return pool_push(pool, &pool->executors[next % pool->size].deque, conn);
+}
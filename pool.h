@@ -0,0 +1,47 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "el.h"
+
+#define POOL_MAX 256
+
+// VMs waiting for one executor. It runs them from the front, new and
+// preempted VMs join at the back and idle executors steal from there
+typedef struct {
+    pthread_mutex_t lock;
+    Conn **conns;
+    size_t capacity;
+    size_t head;
+    size_t size;
+} Deque;
+
+typedef struct {
+    struct Pool *pool;
+    uint32_t id;
+    pthread_t thread;
+    Deque deque;
+} Executor;
+
+// Threads running the VMs of every event loop. A VM is in exactly one
+// deque or on exactly one executor until it is done, then it goes back
+// to the event loop of its connection with el_done()
+typedef struct Pool {
+    Executor executors[POOL_MAX];
+    uint32_t size;
+    uint32_t next; // deque the next submitted VM goes to
+    size_t queued; // VMs in the deques
+    uint32_t sleeping; // executors waiting for queued
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    void (*init)(void); // on every executor before the first VM
+    bool (*run)(Conn *conn, size_t runnable); // one slice, true if not done
+} Pool;
+
+bool pool_init(Pool *pool, uint32_t size, void (*init)(void),
+        bool (*run)(Conn *conn, size_t runnable));
+bool pool_submit(Pool *pool, Conn *conn);
+
+#endif
@@ -4,6 +4,7 @@
 #include <assert.h>
 
 #include "program.h"
+#include "utils.h"
 
 bool program_init(Program *program)
 {
@@ -106,14 +107,33 @@ bool program_merge(Program *program, Instruction *src, size_t size)
     return program_insert(program, src, program->size, size);
 }
 
+// Room for size more instructions at the end, written in place and
+// added with program_extend(). The capacity at least doubles when it
+// grows so that appending a little at a time stays linear
+Instruction *program_reserve(Program *program, size_t size)
+{
+    if (program->size + size > program->capacity) {
+        size_t capacity_new = MAX(program->size + size, 2 * program->capacity);
+        if (!program_resize(program, capacity_new)) {
+            return NULL;
+        }
+    }
+
+    return program->items + program->size;
+}
+
+void program_extend(Program *program, size_t size)
+{
+    program->size += size;
+}
+
 bool program_insert(Program *program, Instruction *src, size_t start, size_t size)
 {
     if (start > program->size) {
         return false;
     }
 
-    bool rv = program_resize(program, program->capacity + size);
-    if (!rv) {
+    if (!program_reserve(program, size)) {
         return false;
     }
 
@@ -314,6 +334,34 @@ bool opcode_decode(char *buffer, OpCode *code)
         *code = RETI;
     } else if (strcmp(buffer, "halt") == 0) {
         *code = HALT;
+    } else if (strcmp(buffer, "hallo") == 0) {
+        *code = HALLO;
+    } else if (strcmp(buffer, "hfree") == 0) {
+        *code = HFREE;
+    } else if (strcmp(buffer, "load") == 0) {
+        *code = LOAD;
+    } else if (strcmp(buffer, "store") == 0) {
+        *code = STORE;
+    } else if (strcmp(buffer, "mcpy") == 0) {
+        *code = MCPY;
+    } else if (strcmp(buffer, "mset") == 0) {
+        *code = MSET;
+    } else if (strcmp(buffer, "vadd") == 0) {
+        *code = VADD;
+    } else if (strcmp(buffer, "vsub") == 0) {
+        *code = VSUB;
+    } else if (strcmp(buffer, "vmul") == 0) {
+        *code = VMUL;
+    } else if (strcmp(buffer, "vdot") == 0) {
+        *code = VDOT;
+    } else if (strcmp(buffer, "vsum") == 0) {
+        *code = VSUM;
+    } else if (strcmp(buffer, "vmin") == 0) {
+        *code = VMIN;
+    } else if (strcmp(buffer, "vmax") == 0) {
+        *code = VMAX;
+    } else if (strcmp(buffer, "vcmp") == 0) {
+        *code = VCMP;
     } else {
         return false;
     }
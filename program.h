@@ -31,7 +31,22 @@ typedef enum {
     BLEI,
     RET,
     RETI,
-    HALT
+    HALT,
+    HALLO,
+    HFREE,
+    LOAD,
+    STORE,
+    MCPY,
+    MSET,
+    VADD,
+    VSUB,
+    VMUL,
+    VDOT,
+    VSUM,
+    VMIN,
+    VMAX,
+    VCMP,
+    OPCODE_COUNT
 } OpCode;
 
 const static char *opcode_of[] = {
@@ -61,6 +76,20 @@ const static char *opcode_of[] = {
     [RET]   = "ret",
     [RETI]  = "reti",
     [HALT]  = "halt",
+    [HALLO] = "hallo",
+    [HFREE] = "hfree",
+    [LOAD]  = "load",
+    [STORE] = "store",
+    [MCPY]  = "mcpy",
+    [MSET]  = "mset",
+    [VADD]  = "vadd",
+    [VSUB]  = "vsub",
+    [VMUL]  = "vmul",
+    [VDOT]  = "vdot",
+    [VSUM]  = "vsum",
+    [VMIN]  = "vmin",
+    [VMAX]  = "vmax",
+    [VCMP]  = "vcmp",
 };
 
 // This is the supposed maximum length of a
@@ -94,6 +123,8 @@ bool program_inc_capacity(Program *program);
 bool program_clear(Program *program);
 bool program_clone(Program *dst, Program *src);
 bool program_copy(Program *program, Program *src);
+Instruction *program_reserve(Program *program, size_t size);
+void program_extend(Program *program, size_t size);
 bool program_merge(Program *program, Instruction *src, size_t size);
 bool program_insert(Program *program, Instruction *src, size_t start, size_t size);
 bool program_split(Program *program, Instruction *dst, size_t size);
@@ -6,6 +6,11 @@
 
 #include "program.h"
 #include "client.h"
+#include "server.h"
+#include "code.h"
+#include "sched.h"
+#include "cache.h"
+#include "el.h"
 #include "utils.h"
 #include "vm.h"
 
@@ -75,9 +80,9 @@ static void repl_get(int fd)
     program_deinit(&program);
 }
 
-static void repl_exec(int fd)
+static void repl_exec(int fd, int32_t *args, uint32_t n)
 {
-    if (client_exec(fd)) {
+    if (client_exec_args(fd, args, n)) {
         printf("Execution started\n");
     } else {
         fprintf(stderr, "Failed to execute remote program\n");
@@ -106,6 +111,206 @@ static void repl_dump(int fd, uint32_t size)
     free(memory);
 }
 
+static void repl_fusion(int fd)
+{
+    static const char *fused_of[FUSED_COUNT] = {
+        [MOV_SUBI - OPCODE_COUNT]     = "mov+subi",
+        [MOV_MOV - OPCODE_COUNT]      = "mov+mov",
+        [SUBI_BEQI - OPCODE_COUNT]    = "subi+beqi",
+        [SUBI_BNEI - OPCODE_COUNT]    = "subi+bnei",
+        [ADDI_BNEI - OPCODE_COUNT]    = "addi+bnei",
+        [ADD_B - OPCODE_COUNT]        = "add+b",
+        [MUL_B - OPCODE_COUNT]        = "mul+b",
+        [BEQI_B - OPCODE_COUNT]       = "beqi+b",
+        [ADD_MOV_MOV - OPCODE_COUNT]  = "add+mov+mov",
+        [MOV_MOV_BEQI - OPCODE_COUNT] = "mov+mov+beqi",
+    };
+
+    int32_t fused[FUSED_COUNT];
+    if (client_dump_section(fd, DUMP_FUSION, fused, FUSED_COUNT)) {
+        for (size_t i = 0; i < FUSED_COUNT; i++) {
+            printf("%-14s %d\n", fused_of[i], fused[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get fusion counters\n");
+    }
+}
+
+static void repl_cfg(int fd)
+{
+    static const char *stat_of[CFG_STAT_COUNT] = {
+        [CFG_BLOCKS]     = "blocks",
+        [CFG_BACK_EDGES] = "back-edges",
+        [CFG_EXITS]      = "exits",
+    };
+
+    int32_t stats[CFG_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_CFG, stats, CFG_STAT_COUNT)) {
+        for (size_t i = 0; i < CFG_STAT_COUNT; i++) {
+            printf("%-14s %d\n", stat_of[i], stats[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get control-flow graph\n");
+    }
+}
+
+static void repl_jit(int fd)
+{
+    static const char *stat_of[JIT_STAT_COUNT] = {
+        [JIT_NATIVE] = "native",
+        [JIT_BAILS]  = "bail outs",
+    };
+
+    int32_t stats[JIT_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_JIT, stats, JIT_STAT_COUNT)) {
+        for (size_t i = 0; i < JIT_STAT_COUNT; i++) {
+            printf("%-14s %d\n", stat_of[i], stats[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get JIT counters\n");
+    }
+}
+
+static void repl_sched(int fd)
+{
+    static const char *stat_of[SCHED_STAT_COUNT] = {
+        [SCHED_QUANTUM]     = "quantum us",
+        [SCHED_BUDGET]      = "budget",
+        [SCHED_PS_PER_INST] = "ps per inst",
+        [SCHED_SLICES]      = "slices",
+        [SCHED_LATENCY_AVG] = "latency avg us",
+        [SCHED_LATENCY_MAX] = "latency max us",
+    };
+
+    int32_t stats[SCHED_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_SCHED, stats, SCHED_STAT_COUNT)) {
+        for (size_t i = 0; i < SCHED_STAT_COUNT; i++) {
+            printf("%-14s %d\n", stat_of[i], stats[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get scheduler counters\n");
+    }
+}
+
+static void repl_accept(int fd)
+{
+    static const char *stat_of[ACCEPT_STAT_COUNT] = {
+        [ACCEPT_TOTAL]     = "accepted",
+        [ACCEPT_RATE]      = "per second",
+        [ACCEPT_BATCH_MAX] = "batch max",
+        [ACCEPT_FAILURES]  = "failures",
+        [ACCEPT_SHED]      = "shed",
+    };
+
+    int32_t stats[ACCEPT_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_ACCEPT, stats, ACCEPT_STAT_COUNT)) {
+        for (size_t i = 0; i < ACCEPT_STAT_COUNT; i++) {
+            printf("%-14s %d\n", stat_of[i], stats[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get accept counters\n");
+    }
+}
+
+static void repl_cache(int fd)
+{
+    static const char *stat_of[CACHE_STAT_COUNT] = {
+        [CACHE_HITS]         = "hits",
+        [CACHE_MISSES]       = "misses",
+        [CACHE_INSERTS]      = "inserts",
+        [CACHE_EVICTIONS]    = "evictions",
+        [CACHE_ENTRIES]      = "images",
+        [CACHE_INSTRUCTIONS] = "instructions",
+        [CACHE_BOUND]        = "bound",
+    };
+
+    int32_t stats[CACHE_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_CACHE, stats, CACHE_STAT_COUNT)) {
+        for (size_t i = 0; i < CACHE_STAT_COUNT; i++) {
+            printf("%-14s %d\n", stat_of[i], stats[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get cache counters\n");
+    }
+}
+
+static void repl_slab(int fd)
+{
+    static const char *stat_of[SLAB_STAT_COUNT] = {
+        [SLAB_LIVE]        = "live",
+        [SLAB_FREE]        = "free",
+        [SLAB_CARVED]      = "carved",
+        [SLAB_ARENAS]      = "arenas",
+        [SLAB_HUGE_ARENAS] = "huge arenas",
+    };
+
+    static const char *slab_of[EL_SLAB_COUNT] = {
+        [EL_SLAB_CONN] = "connections",
+        [EL_SLAB_VM]   = "vms",
+        [EL_SLAB_BUF]  = "buffers",
+    };
+
+    int32_t stats[EL_SLAB_COUNT][SLAB_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_SLAB, &stats[0][0], EL_SLAB_COUNT * SLAB_STAT_COUNT)) {
+        printf("%-14s", "");
+        for (size_t i = 0; i < EL_SLAB_COUNT; i++) {
+            printf(" %12s", slab_of[i]);
+        }
+        printf("\n");
+        for (size_t i = 0; i < SLAB_STAT_COUNT; i++) {
+            printf("%-14s", stat_of[i]);
+            for (size_t j = 0; j < EL_SLAB_COUNT; j++) {
+                printf(" %12d", stats[j][i]);
+            }
+            printf("\n");
+        }
+    } else {
+        fprintf(stderr, "Failed to get slab counters\n");
+    }
+}
+
+static void repl_heap(int fd)
+{
+    static const char *stat_of[HEAP_STAT_COUNT] = {
+        [HEAP_ALLOCS]      = "allocs",
+        [HEAP_FREES]       = "frees",
+        [HEAP_FAILURES]    = "failures",
+        [HEAP_REUSED]      = "reused",
+        [HEAP_LIVE_BLOCKS] = "live blocks",
+        [HEAP_LIVE_WORDS]  = "live words",
+        [HEAP_PEAK_WORDS]  = "peak words",
+        [HEAP_TOP_WORDS]   = "top words",
+    };
+
+    int32_t stats[HEAP_STAT_COUNT];
+    if (client_dump_section(fd, DUMP_HEAP, stats, HEAP_STAT_COUNT)) {
+        for (size_t i = 0; i < HEAP_STAT_COUNT; i++) {
+            printf("%-14s %d\n", stat_of[i], stats[i]);
+        }
+    } else {
+        fprintf(stderr, "Failed to get heap counters\n");
+    }
+}
+
+static void repl_setup(int fd, uint32_t size)
+{
+    if (client_setup(fd, &size)) {
+        printf("Memory size: %u words\n", size);
+    } else {
+        fprintf(stderr, "Failed to set up memory\n");
+    }
+}
+
+static void repl_pages(int fd)
+{
+    int32_t pages[DUMP_PAGES_SIZE];
+    if (client_dump_section(fd, DUMP_PAGES, pages, DUMP_PAGES_SIZE)) {
+        printf("Memory size: %d words, %d pages touched\n", pages[0], pages[1]);
+    } else {
+        fprintf(stderr, "Failed to get memory pages\n");
+    }
+}
+
 static void repl_save(int fd, char *filename)
 {
     Program program;
@@ -142,11 +347,25 @@ static void repl_help()
         "       - this command will enter `merge mode`\n"
         "       - you can write assembly in this format <opcode> <dest> <arg1> <arg2>\n"
         "   - get: get the current state of the server\n"
-        "   - exec: execute the current state of the server\n"
+        "   - exec [args]: execute the current state of the server, the first 4\n"
+        "     arguments go to registers 0 to 3 and the rest are pushed on the stack\n"
         "   - delete <start> <size>: delete <size> instructions starting from <start>\n"
         "   - dump <size>: get memory dump of the first <size> integers in the vm data\n"
+        "   - fusion: show how many times each instruction fusion fired\n"
+        "   - cfg: show the basic blocks, back-edges and exits of the last run program\n"
+        "   - jit: show how many instructions of the last run were native and the bail outs\n"
+        "   - sched: show the scheduler quantum and the latency it achieved\n"
+        "   - slab: show the connections, VMs and buffers the server allocated and kept\n"
+        "   - accept: show how many connections the server accepted and shed\n"
+        "   - cache: show the hits, misses and evictions of the program image cache\n"
+        "   - heap: show the guest heap allocator counters of the last run\n"
+        "   - setup <size>: clear the memory and resize it to <size> words\n"
+        "   - pages: show the memory size and how many pages were touched\n"
         "   - save <filename>: get the remote state and save it to <filename>\n"
         "   - load <filename>: load <filename> state and merge it to the remote state\n"
+        "Range opcodes (mcpy, mset, vadd, vsub, vmul, vdot, vsum, vmin, vmax, vcmp)\n"
+        "take slots holding addresses and lengths, `vsum 0 1 2` stores in slot 0\n"
+        "the sum of memory[2] words starting at address memory[1]\n"
         "Example usage:\n"
         "   $ merge\n"
         "   > movi 0 69420\n"
@@ -193,7 +412,16 @@ int main()
         } else if (strcmp(cmd, "get") == 0) {
             repl_get(fd);
         } else if (strcmp(cmd, "exec") == 0) {
-            repl_exec(fd);
+            int32_t args[EXEC_ARGS_MAX];
+            uint32_t n = 0;
+            int offset = 0, used;
+            sscanf(buffer, "%*s%n", &offset);
+            while (n < EXEC_ARGS_MAX
+                    && sscanf(buffer + offset, "%d%n", &args[n], &used) == 1) {
+                offset += used;
+                n++;
+            }
+            repl_exec(fd, args, n);
         } else if (strcmp(cmd, "delete") == 0) {
             uint32_t start = 0, size = 0;
             sscanf(buffer, "%*s %d %d", &start, &size);
@@ -202,6 +430,28 @@ int main()
             uint32_t size = 0;
             sscanf(buffer, "%*s %d", &size);
             repl_dump(fd, size);
+        } else if (strcmp(cmd, "fusion") == 0) {
+            repl_fusion(fd);
+        } else if (strcmp(cmd, "cfg") == 0) {
+            repl_cfg(fd);
+        } else if (strcmp(cmd, "jit") == 0) {
+            repl_jit(fd);
+        } else if (strcmp(cmd, "sched") == 0) {
+            repl_sched(fd);
+        } else if (strcmp(cmd, "slab") == 0) {
+            repl_slab(fd);
+        } else if (strcmp(cmd, "accept") == 0) {
+            repl_accept(fd);
+        } else if (strcmp(cmd, "cache") == 0) {
+            repl_cache(fd);
+        } else if (strcmp(cmd, "heap") == 0) {
+            repl_heap(fd);
+        } else if (strcmp(cmd, "setup") == 0) {
+            uint32_t size = 0;
+            sscanf(buffer, "%*s %u", &size);
+            repl_setup(fd, size);
+        } else if (strcmp(cmd, "pages") == 0) {
+            repl_pages(fd);
         } else if (strcmp(cmd, "save") == 0) {
             char filename[FILENAME_SIZE] = {0};
             sscanf(buffer, "%*s %s", filename);
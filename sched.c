@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "sched.h"
+#include "program.h"
+#include "vm.h"
+
+// Weight of the last slice in the running cost of an instruction
+#define SCHED_SMOOTHING 0.125
+// Slices shorter than this are mostly clock and dispatch overhead
+#define SCHED_SAMPLE_MIN 1024
+
+void sched_init(Sched *sched)
+{
+    sched->ns_per_inst = 1.0;
+    sched->latency_sum = 0;
+    sched->latency_max = 0;
+    for (size_t i = 0; i < SCHED_STAT_COUNT; i++) {
+        sched->stats[i] = 0;
+    }
+
+    sched_plan(sched, 1, 0);
+}
+
+uint64_t sched_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Time a mixed arithmetic loop until it runs out of time, the best of
+// a few runs is taken as the cost of an instruction
+void sched_calibrate(Sched *sched)
+{
+    Instruction insts[] = {
+        { MOVI,    R1, 0 },
+        { ADDI,    R1, R1, 1 },
+        { MUL,     R2, R1, R1 },
+        { ADD,     R0, R0, R2 },
+        { SUB,     R3, R0, R1 },
+        { BNEI,    1, R1, -1 },
+    };
+
+    Vm vm;
+    vm_init(&vm);
+    for (size_t i = 0; i < sizeof(insts) / sizeof(insts[0]); i++) {
+        program_add(vm.program, insts[i]);
+    }
+    vm.slice = TIMER_LIMIT + 1;
+
+    double best = 0;
+    for (int run = 0; run < 3; run++) {
+        vm_setreg(&vm);
+        uint64_t start = sched_now();
+        LoopResult res;
+        do {
+            res = loop(&vm);
+        } while (res == LR_CONTEXT_CHANGED);
+        uint64_t elapsed = sched_now() - start;
+
+        double ns = (double)elapsed / vm.timer;
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+    vm_deinit(&vm);
+
+    sched->ns_per_inst = best;
+    sched_plan(sched, 1, 0);
+}
+
+// Pick the quantum for the next round: the target latency shared by
+// the runnable VMs, cut short while there is I/O to get back to
+void sched_plan(Sched *sched, size_t runnable, size_t pending)
+{
+    uint64_t quantum = SCHED_LATENCY_US / (runnable ? runnable : 1);
+    if (pending && quantum > SCHED_QUANTUM_IO_US)
+        quantum = SCHED_QUANTUM_IO_US;
+    if (quantum < SCHED_QUANTUM_MIN_US)
+        quantum = SCHED_QUANTUM_MIN_US;
+    if (quantum > SCHED_QUANTUM_MAX_US)
+        quantum = SCHED_QUANTUM_MAX_US;
+
+    // No program runs longer than the time limit anyway
+    double budget = quantum * 1000 / sched->ns_per_inst;
+    if (budget > TIMER_LIMIT + 1)
+        budget = TIMER_LIMIT + 1;
+    if (budget < CONTEXT_SIZE)
+        budget = CONTEXT_SIZE;
+
+    sched->stats[SCHED_QUANTUM] = (uint32_t)quantum;
+    sched->stats[SCHED_BUDGET] = (uint32_t)budget;
+    sched->stats[SCHED_PS_PER_INST] = (uint32_t)(sched->ns_per_inst * 1000);
+}
+
+// A VM runnable since ready got the CPU at now
+void sched_wait(Sched *sched, uint64_t ready, uint64_t now)
+{
+    uint64_t latency = now > ready ? now - ready : 0;
+    sched->latency_sum += latency;
+    if (latency > sched->latency_max)
+        sched->latency_max = latency;
+
+    sched->stats[SCHED_SLICES]++;
+    sched->stats[SCHED_LATENCY_AVG] =
+        (uint32_t)(sched->latency_sum / sched->stats[SCHED_SLICES] / 1000);
+    sched->stats[SCHED_LATENCY_MAX] = (uint32_t)(sched->latency_max / 1000);
+}
+
+// A slice charged executed instructions in elapsed ns
+void sched_ran(Sched *sched, uint32_t executed, uint64_t elapsed)
+{
+    if (executed < SCHED_SAMPLE_MIN)
+        return;
+
+    double ns = (double)elapsed / executed;
+    sched->ns_per_inst += (ns - sched->ns_per_inst) * SCHED_SMOOTHING;
+}
@@ -0,0 +1,45 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Every runnable VM should get a slice within this long, the quantum
+// is this round divided between them
+#define SCHED_LATENCY_US 4000
+#define SCHED_QUANTUM_MIN_US 50
+#define SCHED_QUANTUM_MAX_US 10000
+// Quantum while other connections have I/O waiting to be handled
+#define SCHED_QUANTUM_IO_US 250
+
+// Counters read by DUMP with the DUMP_SCHED section
+typedef enum {
+    SCHED_QUANTUM, // current quantum in microseconds
+    SCHED_BUDGET, // the quantum in instructions
+    SCHED_PS_PER_INST, // calibrated cost of an instruction in picoseconds
+    SCHED_SLICES, // slices run so far
+    SCHED_LATENCY_AVG, // from runnable to running in microseconds
+    SCHED_LATENCY_MAX,
+    SCHED_STAT_COUNT
+} SchedStat;
+
+// Time based round robin over the runnable VMs. Quanta are converted
+// to instruction budgets with the measured cost of an instruction,
+// which starts from a calibration run and follows the slices that
+// actually ran
+typedef struct {
+    double ns_per_inst;
+    uint64_t latency_sum; // in ns
+    uint64_t latency_max;
+    uint32_t stats[SCHED_STAT_COUNT];
+} Sched;
+
+void sched_init(Sched *sched);
+void sched_calibrate(Sched *sched);
+uint64_t sched_now(void);
+void sched_plan(Sched *sched, size_t runnable, size_t pending);
+void sched_wait(Sched *sched, uint64_t ready, uint64_t now);
+void sched_ran(Sched *sched, uint32_t executed, uint64_t elapsed);
+
+#endif
@@ -1,23 +1,81 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <assert.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
 #include "el.h"
+#include "code.h"
+#include "vec.h"
+#include "sched.h"
+#include "uring.h"
+#include "pool.h"
+#include "cache.h"
 #include "utils.h"
 #include "server.h"
 
-static int welcfd = -1;
+// A thread serving the connections of its own listening socket. The
+// workers share nothing, every one has its own event loop, scheduler
+// and VMs
+typedef struct {
+    uint32_t id;
+    int welcfd;
+    pthread_t thread;
+} Worker;
+
+static Worker workers[WORKERS_MAX];
+static uint32_t worker_count;
+static Pool pool; // no executors means VMs run on the workers
+
+// Of the worker running on this thread
+static __thread int welcfd = -1;
+static __thread int reserve_fd = -1; // given up to shed connections on EMFILE
+static __thread Sched sched;
+static __thread Cache cache;
+static __thread uint32_t accept_stats[ACCEPT_STAT_COUNT];
+static __thread uint64_t accept_window; // start of the ACCEPT_RATE second
+static __thread uint32_t accept_window_count;
+
+// A RUN from its request to its reply, kept in a buffer of the
+// connection. The pokes are followed by the ranges
+typedef struct {
+    RunHeader args;
+    uint8_t data[];
+} Job;
+
+_Static_assert(
+    sizeof(Job) + RUN_ARGS_MAX * sizeof(RunRange) <= BUF_SIZE,
+    "A Job should fit in a connection buffer"
+);
+
+_Static_assert(SHA256_SIZE <= PAYLOAD_SIZE, "A digest should fit in a payload");
+
+ServerConfig server_config = {
+    .jit = false,
+    .memory_max = 1 << 20,
+    .uring = true,
+    .workers = 1,
+    .pin = false,
+    .executors = 0,
+    .hugepages = false,
+    .accept_batch = 64,
+    .cache_size = 1 << 20,
+};
 
 void sigquit_handler(int n)
 {
     printf("Closing welcome socket...\n");
-    close(welcfd);
+    // The accept request of io_uring holds on to the socket until the
+    // ring is torn down after exit, stop listening right away
+    for (uint32_t i = 0; i < worker_count; i++) {
+        shutdown(workers[i].welcfd, SHUT_RDWR);
+        close(workers[i].welcfd);
+    }
     exit(0);
 }
 
@@ -28,7 +86,9 @@ bool handle_connection(Conn *conn)
             handle_request(conn);
             break;
         case CONN_RES:
-            handle_response(conn);
+            // Drained enough to take requests again
+            if (handle_response(conn) && conn->state == CONN_REQ)
+                handle_request(conn);
             break;
         case CONN_LOOP:
             handle_loop(conn);
@@ -37,16 +97,365 @@ bool handle_connection(Conn *conn)
             return false;
     }
 
+    // EOF or a failure while serving, the fd has to be closed
+    return conn->state != CONN_END;
+}
+
+// Whether req reads or changes the VM, the others are served without
+// setting one up
+static bool uses_vm(Request *req)
+{
+    if (req->header.type == DUMP) {
+        uint32_t section = DUMP_MEMORY;
+        if (req->header.size >= 3 * sizeof(uint32_t)) {
+            section = ((uint32_t *)req->payload)[2];
+        }
+        return section != DUMP_SCHED && section != DUMP_SLAB && section != DUMP_ACCEPT
+            && section != DUMP_CACHE;
+    }
+
+    return (req->header.type >= MERGE && req->header.type <= SETUP)
+        || req->header.type == BIND || req->header.type == PUBLISH;
+}
+
+static ConnState handle_method(Conn *conn, Request *req, Response *res)
+{
+    switch (req->header.type) {
+        case MERGE:
+            return handle_merge(conn, req, res);
+        case INSERT:
+            return handle_insert(conn, req, res);
+        case EXEC:
+            return handle_exec(conn, req, res);
+        case RESET:
+            return handle_reset(conn, res);
+        case GET:
+            return handle_get(conn, req, res);
+        case DELETE:
+            return handle_delete(conn, req, res);
+        case DUMP:
+            return handle_dump(conn, req, res);
+        case SETUP:
+            return handle_setup(conn, req, res);
+        case HELLO:
+            return handle_hello(conn, req, res);
+        case NOTIFY:
+            return handle_notify(conn, req, res);
+        case BIND:
+            return handle_bind(conn, req, res);
+        case PUBLISH:
+            return handle_publish(conn, res);
+        default:
+            res->header.status = UNKNOWN_METHOD;
+            res->header.size = 0;
+            return CONN_RES;
+    }
+}
+
+// Reply with the index of the offending instruction and the reason
+static void verify_failure(Response *res, size_t index, InstResult why)
+{
+    res->header.status = FAILURE;
+    res->header.size = 2 * sizeof(uint32_t);
+    ((uint32_t *)res->payload)[0] = (uint32_t)index;
+    ((uint32_t *)res->payload)[1] = (uint32_t)why;
+}
+
+// Receive the next size bytes into dst, starting with what came along
+// in rbuf, see handle_stream()
+static bool stream_start(Conn *conn, uint8_t *dst, size_t size)
+{
+    conn->stream = dst;
+    conn->stream_left = size;
+
+    size_t first = MIN(conn->rbuf_size, size);
+    conn_rbuf_peek(conn, dst, first);
+    conn_rbuf_drop(conn, first);
+    conn_release(conn);
+
+    return handle_stream(conn, first);
+}
+
+static bool run_start(Conn *conn);
+
+// Start receiving a version 2 MERGE frame. Its payload goes straight to
+// the end of the program, past its size until the frame is complete
+static bool handle_upload(Conn *conn, RequestHeader *header)
+{
+    if (header->size > FRAME_MAX || header->size % sizeof(Instruction)) {
+        printf("Malformed upload frame\n");
+        conn->state = CONN_END;
+        return false;
+    }
+
+    // Backpressure, the frame is answered like any other request
+    if (conn->wbuf_size >= WBUF_MAX) {
+        return false;
+    }
+
+    Vm *vm = conn_vm(conn);
+    Program *program = vm ? vm_edit(vm) : NULL;
+    uint8_t *dst = NULL;
+    if (program) {
+        dst = (uint8_t *)program_reserve(program, header->size / sizeof(Instruction));
+    }
+    if (!dst) {
+        printf("Failed to allocate upload\n");
+        conn->state = CONN_END;
+        return false;
+    }
+
+    if (!conn->upload_more) {
+        conn->upload_base = (uint32_t)program_size(program);
+        conn->upload_why = OK;
+    }
+    conn->upload_more = (header->type & FRAME_MORE) != 0;
+
+    conn_rbuf_drop(conn, sizeof(*header));
+    return stream_start(conn, dst, header->size);
+}
+
+// Account for bytes received into the frame being streamed. Once it is
+// complete its instructions are checked and join the program, and the
+// last frame of the upload is answered. A rejected instruction undoes
+// the whole upload
+bool handle_stream(Conn *conn, size_t bytes)
+{
+    conn->stream += bytes;
+    conn->stream_left -= bytes;
+    if (conn->stream_left) {
+        return true;
+    }
+
+    Vm *vm = conn->vm;
+    Program *program = vm->program;
+    Instruction *insts = program_data(program) + program_size(program);
+    size_t n = (size_t)(conn->stream - (uint8_t *)insts) / sizeof(Instruction);
+    conn->stream = NULL;
+
+    for (size_t i = 0; i < n && conn->upload_why == OK; i++) {
+        InstResult why = code_verify_inst(&insts[i], vm_memory_size(vm));
+        if (why != OK) {
+            printf("Rejected instruction %zu: %s\n", program_size(program) + i, res_names[why]);
+            conn->upload_index = (uint32_t)(program_size(program) + i);
+            conn->upload_why = why;
+            program_delete(program, conn->upload_base, program_size(program) - conn->upload_base);
+        }
+    }
+
+    vm_invalidate(vm);
+    if (conn->upload_why == OK) {
+        program_extend(program, n);
+    }
+
+    if (conn->upload_more) {
+        return true;
+    }
+
+    // The program of a RUN
+    if (conn->job) {
+        return run_start(conn);
+    }
+
+    printf("MERGE...\n");
+    Response *res = (Response *)conn_wbuf_reserve(conn, sizeof(Response));
+    if (!res) {
+        conn->state = CONN_END;
+        return false;
+    }
+
+    if (conn->upload_why != OK) {
+        verify_failure(res, conn->upload_index, conn->upload_why);
+    } else {
+        res->header.status = SUCCESS;
+        res->header.size = 0;
+    }
+    conn_wbuf_commit(conn, sizeof(res->header) + res->header.size);
+    return true;
+}
+
+// Parse a RUN once its header, pokes and ranges are in rbuf. They are
+// kept until the reply, the program after them is streamed into the VM
+// like an upload
+static bool handle_run(Conn *conn, RequestHeader *header)
+{
+    struct {
+        RequestHeader header;
+        RunHeader args;
+    } head;
+    if (conn->rbuf_size < sizeof(head)) {
+        return false;
+    }
+    conn_rbuf_peek(conn, &head, sizeof(head));
+
+    RunHeader *args = &head.args;
+    size_t args_size = sizeof(*args) + (size_t)args->pokes * sizeof(RunPoke)
+        + (size_t)args->ranges * sizeof(RunRange);
+    if (args->pokes > RUN_ARGS_MAX || args->ranges > RUN_ARGS_MAX - args->pokes
+            || args_size > header->size || header->size - args_size > FRAME_MAX
+            || (header->size - args_size) % sizeof(Instruction)) {
+        printf("Malformed RUN\n");
+        conn->state = CONN_END;
+        return false;
+    }
+
+    if (conn->rbuf_size < sizeof(*header) + args_size) {
+        return false;
+    }
+
+    // Backpressure, the reply waits in wbuf like any other
+    if (conn->wbuf_size >= WBUF_MAX) {
+        return false;
+    }
+
+    printf("RUN...\n");
+    Vm *vm = conn_vm(conn);
+    Job *job = vm ? (Job *)conn_buf(conn) : NULL;
+    if (!job) {
+        conn->state = CONN_END;
+        return false;
+    }
+
+    conn_rbuf_drop(conn, sizeof(*header));
+    conn_rbuf_peek(conn, &job->args, args_size);
+    conn_rbuf_drop(conn, args_size);
+    conn->job = job;
+    conn->upload_more = false;
+    conn->upload_why = OK;
+
+    size_t n = (header->size - args_size) / sizeof(Instruction);
+    if (!n) {
+        conn_release(conn);
+        return run_start(conn);
+    }
+
+    vm_unbind(vm);
+    vm_invalidate(vm);
+    program_clear(vm->program);
+    uint8_t *dst = (uint8_t *)program_reserve(vm->program, n);
+    if (!dst) {
+        printf("Failed to allocate upload\n");
+        conn->state = CONN_END;
+        return false;
+    }
+    conn->upload_base = 0;
+
+    return stream_start(conn, dst, n * sizeof(Instruction));
+}
+
+// Handle the first request of rbuf if it is complete and queue its
+// response in wbuf, false if there is none or the queue is full. The
+// request is parsed in place unless it wraps around the end of rbuf, or
+// payloads of odd sizes before it left it misaligned
+bool handle_next(Conn *conn)
+{
+    // Check if the header is ready to be read, and not the payload of
+    // a large frame
+    if (conn->rbuf_size < sizeof(RequestHeader) || conn->stream_left) {
+        return false;
+    }
+
+    // Read header
+    RequestHeader header;
+    conn_rbuf_peek(conn, &header, sizeof(header));
+
+    if (conn->version >= 2 && (header.type & ~FRAME_MORE) == MERGE) {
+        return handle_upload(conn, &header);
+    }
+    if (conn->version >= 2 && header.type == RUN) {
+        return handle_run(conn, &header);
+    }
+
+    // It would never fit in rbuf, nor in a Request
+    if (header.size > PAYLOAD_SIZE) {
+        printf("Request too large\n");
+        conn->state = CONN_END;
+        return false;
+    }
+
+    // Check if the payload is ready to be read
+    size_t req_size = sizeof(header) + header.size;
+    if (conn->rbuf_size < req_size) {
+        return false;
+    }
+
+    // Backpressure, wait for the client to read its responses
+    if (conn->wbuf_size >= WBUF_MAX) {
+        return false;
+    }
+
+    // The response is built in wbuf
+    Response *res = (Response *)conn_wbuf_reserve(conn, sizeof(Response));
+    if (!res) {
+        return false;
+    }
+    res->header = (ResponseHeader) {0};
+
+    Request wrapped;
+    Request *req = (Request *)(conn->rbuf + conn->rbuf_head);
+    if (conn->rbuf_head + req_size > BUF_SIZE || conn->rbuf_head % _Alignof(Request)) {
+        conn_rbuf_peek(conn, &wrapped, req_size);
+        req = &wrapped;
+    }
+
+    ConnState state = CONN_RES;
+    size_t queued = conn->wbuf_size;
+    if (uses_vm(req) && !conn_vm(conn)) {
+        res->header.status = FAILURE;
+        res->header.size = 0;
+    } else {
+        state = handle_method(conn, req, res);
+    }
+
+    // Unless a large response was queued already, see respond()
+    if (conn->wbuf_size == queued) {
+        conn_wbuf_commit(conn, sizeof(res->header) + res->header.size);
+    }
+
+    // Queued, it goes out with the others
+    conn->state = state == CONN_RES ? CONN_REQ : state;
+
+    conn_rbuf_drop(conn, req_size);
+    conn_release(conn);
+
     return true;
 }
 
+// Use this for pipelining, answer every request of rbuf and send the
+// responses together. The ones after an EXEC wait for its VM
+static void handle_pipelined(Conn *conn)
+{
+    while (conn->state == CONN_REQ && handle_next(conn)) {
+    }
+    handle_response(conn);
+}
+
 bool handle_request(Conn *conn)
 {
+    // What the backpressure left in rbuf first
+    handle_pipelined(conn);
+
     while (conn->state == CONN_REQ) {
+        // Into the frame being streamed or rbuf, full when the requests
+        // wait for room in wbuf
+        struct iovec iov[2];
+        int count = 1;
+        if (conn->stream_left) {
+            iov[0] = (struct iovec) { conn->stream, conn->stream_left };
+        } else if (conn_rbuf(conn)) {
+            count = conn_rbuf_space(conn, iov);
+        } else {
+            conn->state = CONN_END;
+            return false;
+        }
+
+        if (!count) {
+            break;
+        }
+
         ssize_t bytes = 0;
         do {
-            size_t n = sizeof(conn->rbuf) - conn->rbuf_size;
-            bytes = read(conn->fd, conn->rbuf, n);
+            bytes = readv(conn->fd, iov, count);
         } while (bytes < 0 && errno == EINTR);
 
         // Check if the file is ready for polling
@@ -56,15 +465,14 @@ bool handle_request(Conn *conn)
                 conn->state = CONN_END;
                 return false;
             }
+            conn_release(conn);
             break;
         }
 
         // Check if the request has finished
         if (bytes == 0) {
-            if (conn->rbuf_size > 0) {
-                fprintf(stderr, "Unexpected EOF\n");
-                exit(1);
-                return false;
+            if (conn->rbuf_size > 0 || conn->stream_left) {
+                printf("Unexpected EOF\n");
             } else {
                 printf("EOF\n");
             }
@@ -72,74 +480,28 @@ bool handle_request(Conn *conn)
             break;
         }
 
-        conn->rbuf_size += (size_t)bytes;
-
-        // Use this for pipelining, allow for multiple
-        // requests to be stored inside rbuf simultaneously
-        while (conn->rbuf_size) {
-            // Check if the header is ready to be read
-            if (conn->rbuf_size < sizeof(RequestHeader)) {
-                break;
-            }
-
-            // Read header
-            RequestHeader header;
-            memcpy(&header, conn->rbuf, sizeof(header));
-
-            // Check if the payload is ready to be read
-            if (conn->rbuf_size - sizeof(header) < header.size) {
-                break;
-            }
-
-            // Read payload
-            Request req = { header };
-            memcpy(req.payload, conn->rbuf + sizeof(header), header.size);
-
-            Response res = {0};
-            switch (req.header.type) {
-                case MERGE:
-                    conn->state = handle_merge(conn, &req, &res);
-                    break;
-                case INSERT:
-                    conn->state = handle_insert(conn, &req, &res);
-                    break;
-                case EXEC:
-                    conn->state = handle_exec(conn, &res);
-                    break;
-                case RESET:
-                    conn->state = handle_reset(conn, &res);
-                    break;
-                case GET:
-                    conn->state = handle_get(conn, &req, &res);
-                    break;
-                case DELETE:
-                    conn->state = handle_delete(conn, &req, &res);
-                    break;
-                case DUMP:
-                    conn->state = handle_dump(conn, &req, &res);
-                    break;
-                default:
-                    res.header.status = UNKNOWN_METHOD;
-                    res.header.size = 0;
-                    break;
-            }
+        if (conn->stream_left) {
+            handle_stream(conn, (size_t)bytes);
+        } else {
+            conn->rbuf_size += (size_t)bytes;
+        }
 
-            // Copy response to wbuf
-            size_t res_size = sizeof(res.header) + res.header.size;
-            memcpy(conn->wbuf, &res, res_size);
-            conn->wbuf_size = res_size;
+        handle_pipelined(conn);
+    }
 
-            // Clear rbuf
-            size_t req_size = sizeof(req.header) + req.header.size;
-            size_t remain = conn->rbuf_size - req_size;
-            if (remain) {
-                memmove(conn->rbuf, conn->rbuf + req_size, remain);
-            }
-            conn->rbuf_size = remain;
+    return true;
+}
 
-            if (conn->state == CONN_RES || conn->state == CONN_LOOP) {
-                handle_response(conn);
-            }
+// Check the static operands of the uploaded instructions, branch
+// targets can only be checked once the program is complete (EXEC)
+static bool verify_upload(Vm *vm, Instruction *insts, size_t n, size_t base, Response *res)
+{
+    for (size_t i = 0; i < n; i++) {
+        InstResult why = code_verify_inst(&insts[i], vm_memory_size(vm));
+        if (why != OK) {
+            printf("Rejected instruction %zu: %s\n", base + i, res_names[why]);
+            verify_failure(res, base + i, why);
+            return false;
         }
     }
 
@@ -153,7 +515,21 @@ ConnState handle_merge(Conn *conn, Request *req, Response *res)
     size_t n = bytes / sizeof(Instruction);
 
     Program *program = conn->vm->program;
-    bool rv = program_merge(program, (Instruction *)req->payload, n);
+    Instruction *insts = (Instruction *)req->payload;
+    if (!verify_upload(conn->vm, insts, n, program_size(program), res)) {
+        return CONN_RES;
+    }
+
+    program = vm_edit(conn->vm);
+    if (!program) {
+        printf("Failed to copy program\n");
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    vm_invalidate(conn->vm);
+    bool rv = program_merge(program, insts, n);
     if (!rv) {
         printf("Failed to merge program\n");
         res->header.status = FAILURE;
@@ -161,7 +537,6 @@ ConnState handle_merge(Conn *conn, Request *req, Response *res)
     } else {
         res->header.status = SUCCESS;
         res->header.size = 0;
-        conn->state = CONN_RES;
     }
 
     return CONN_RES;
@@ -171,11 +546,37 @@ ConnState handle_insert(Conn *conn, Request *req, Response *res)
 {
     printf("INSERT...\n");
     Instruction *insts = (Instruction *)req->payload;
-    uint64_t start = ((uint64_t *)insts)[0];
-    uint64_t size = ((uint64_t *)insts)[1];
+    uint64_t start = 0, size = 0;
+
+    // Only 4-aligned, like the rest of the Request
+    if (req->header.size >= 2 * sizeof(uint64_t)) {
+        memcpy(&start, req->payload, sizeof(start));
+        memcpy(&size, req->payload + sizeof(start), sizeof(size));
+    }
 
     Instruction *src = &insts[1];
     Program *program = conn->vm->program;
+    if (req->header.size < 2 * sizeof(uint64_t)
+            || size > (req->header.size - 2 * sizeof(uint64_t)) / sizeof(Instruction)) {
+        printf("Malformed insert request\n");
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    if (!verify_upload(conn->vm, src, size, start, res)) {
+        return CONN_RES;
+    }
+
+    program = vm_edit(conn->vm);
+    if (!program) {
+        printf("Failed to copy program\n");
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    vm_invalidate(conn->vm);
     bool rv = program_insert(program, src, start, size);
     if (!rv) {
         printf("Failed to insert to program\n");
@@ -189,10 +590,45 @@ ConnState handle_insert(Conn *conn, Request *req, Response *res)
     return CONN_RES;
 }
 
-ConnState handle_exec(Conn *conn, Response *res)
+// Get the program of vm ready to run the way the server is set up
+static InstResult exec_prepare(Vm *vm, size_t *index)
+{
+    if (vm->jit_enabled != server_config.jit) {
+        vm->jit_enabled = server_config.jit;
+        vm_invalidate(vm);
+    }
+
+    InstResult why = vm_prepare(vm, index);
+    if (why != OK) {
+        printf("Failed to verify program at %zu: %s\n", *index, res_names[why]);
+    }
+    return why;
+}
+
+// Run the loaded program, from the arguments of req if there are any.
+// The program is kept as it is, so that it runs again on other inputs
+// without being uploaded or verified again
+ConnState handle_exec(Conn *conn, Request *req, Response *res)
 {
     printf("EXEC...\n");
+    size_t index;
+    InstResult why = exec_prepare(conn->vm, &index);
+    if (why != OK) {
+        verify_failure(res, index, why);
+        return CONN_RES;
+    }
+
     vm_setreg(conn->vm);
+    size_t n = req->header.size / sizeof(int32_t);
+    if (!vm_setargs(conn->vm, (int32_t *)req->payload, n)) {
+        printf("Too many arguments\n");
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+    conn->ready = sched_now();
+    conn->started = conn->ready;
+    conn->slices = 0;
     res->header.status = SUCCESS;
     res->header.size = 0;
     return CONN_LOOP;
@@ -201,6 +637,8 @@ ConnState handle_exec(Conn *conn, Response *res)
 ConnState handle_reset(Conn *conn, Response *res)
 {
     printf("RESET...\n");
+    vm_unbind(conn->vm);
+    vm_invalidate(conn->vm);
     bool rv = program_clear(conn->vm->program);
     if (!rv) {
         printf("Failed to reset program\n");
@@ -215,18 +653,48 @@ ConnState handle_reset(Conn *conn, Response *res)
     return CONN_RES;
 }
 
+// Largest response payload of conn
+static size_t payload_max(Conn *conn)
+{
+    return conn->version >= 2 ? FRAME_MAX : PAYLOAD_SIZE;
+}
+
+// Reply with size bytes of src. Past PAYLOAD_SIZE, which only version 2
+// allows, the payload doesn't fit in res and is queued after it
+static void respond(Conn *conn, Response *res, const void *src, size_t size)
+{
+    res->header.status = SUCCESS;
+    res->header.size = (uint32_t)size;
+    if (size <= PAYLOAD_SIZE) {
+        memcpy(res->payload, src, size);
+        return;
+    }
+
+    conn_wbuf_commit(conn, sizeof(res->header));
+    if (!conn_wbuf_write(conn, src, size)) {
+        // The header is out already, the client can't be answered
+        conn->state = CONN_END;
+    }
+}
+
 ConnState handle_get(Conn *conn, Request *req, Response *res)
 {
     printf("GET...\n");
-    size_t start = ((uint32_t *)req->payload)[0];
-    size_t size = ((uint32_t *)req->payload)[1];
-    size = MIN(size, PAYLOAD_SIZE / sizeof(Instruction));
+    size_t start = 0, size = 0;
+    if (req->header.size >= 2 * sizeof(uint32_t)) {
+        start = ((uint32_t *)req->payload)[0];
+        size = ((uint32_t *)req->payload)[1];
+    }
+    size = MIN(size, payload_max(conn) / sizeof(Instruction));
 
     Program *program = conn->vm->program;
-    size_t n = program_get(program, (Instruction *)res->payload, start, size);
+    size_t n = 0;
+    if (start < program_size(program)) {
+        n = MIN(size, program_size(program) - start);
+    }
+
     if (n) {
-        res->header.status = SUCCESS;
-        res->header.size = n * sizeof(Instruction);
+        respond(conn, res, program_fetch(program, start), n * sizeof(Instruction));
     } else {
         res->header.status = FAILURE;
         res->header.size = 0;
@@ -238,9 +706,24 @@ ConnState handle_get(Conn *conn, Request *req, Response *res)
 ConnState handle_delete(Conn *conn, Request *req, Response *res)
 {
     printf("DELETE...\n");
-    size_t start = ((uint32_t *)req->payload)[0];
-    size_t size = ((uint32_t *)req->payload)[1];
+    size_t start = 0, size = 0;
+    if (req->header.size >= 2 * sizeof(uint32_t)) {
+        start = ((uint32_t *)req->payload)[0];
+        size = ((uint32_t *)req->payload)[1];
+    }
+    // Nothing to copy if nothing goes
     Program *program = conn->vm->program;
+    if (start < program_size(program) && size) {
+        program = vm_edit(conn->vm);
+    }
+    if (!program) {
+        printf("Failed to copy program\n");
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    vm_invalidate(conn->vm);
     uint32_t n = program_delete(program, start, size);
 
     if (n) {
@@ -259,15 +742,77 @@ ConnState handle_delete(Conn *conn, Request *req, Response *res)
 ConnState handle_dump(Conn *conn, Request *req, Response *res)
 {
     printf("DUMP...\n");
-    size_t start = ((uint32_t *)req->payload)[0];
-    size_t size = ((uint32_t *)req->payload)[1];
-    int *memory = conn->vm->memory;
-    size = MIN(size, PAYLOAD_SIZE / sizeof(memory[0]));
+    size_t start = 0, size = 0;
+    if (req->header.size >= 2 * sizeof(uint32_t)) {
+        start = ((uint32_t *)req->payload)[0];
+        size = ((uint32_t *)req->payload)[1];
+    }
+    uint32_t section = DUMP_MEMORY;
+    if (req->header.size >= 3 * sizeof(uint32_t)) {
+        section = ((uint32_t *)req->payload)[2];
+    }
 
-    if (start + size < MEMORY_SIZE) {
-        res->header.status = SUCCESS;
-        res->header.size = size * sizeof(memory[0]);
-        memcpy(res->payload, &memory[start], res->header.size);
+    int32_t *words;
+    size_t words_size;
+    int32_t pages[DUMP_PAGES_SIZE];
+    int32_t slabs[EL_SLAB_COUNT * SLAB_STAT_COUNT];
+    switch (section) {
+        case DUMP_MEMORY:
+            words = conn->vm->memory;
+            words_size = vm_memory_size(conn->vm);
+            break;
+        case DUMP_PAGES:
+            pages[0] = (int32_t)vm_memory_size(conn->vm);
+            pages[1] = (int32_t)vm_touched_pages(conn->vm);
+            words = pages;
+            words_size = DUMP_PAGES_SIZE;
+            break;
+        case DUMP_FUSION:
+            words = (int32_t *)conn->vm->code->fused;
+            words_size = FUSED_COUNT;
+            break;
+        case DUMP_CFG:
+            words = (int32_t *)conn->vm->code->cfg;
+            words_size = CFG_STAT_COUNT;
+            break;
+        case DUMP_JIT:
+            words = (int32_t *)conn->vm->jit_stats;
+            words_size = JIT_STAT_COUNT;
+            break;
+        case DUMP_SCHED:
+            words = (int32_t *)sched.stats;
+            words_size = SCHED_STAT_COUNT;
+            break;
+        case DUMP_ACCEPT:
+            words = (int32_t *)accept_stats;
+            words_size = ACCEPT_STAT_COUNT;
+            break;
+        case DUMP_CACHE:
+            cache.stats[CACHE_BOUND] = cache_bound(&cache);
+            words = (int32_t *)cache.stats;
+            words_size = CACHE_STAT_COUNT;
+            break;
+        case DUMP_SLAB:
+            for (size_t i = 0; i < EL_SLAB_COUNT; i++) {
+                memcpy(&slabs[i * SLAB_STAT_COUNT], conn->owner->slabs[i].stats,
+                        sizeof(conn->owner->slabs[i].stats));
+            }
+            words = slabs;
+            words_size = EL_SLAB_COUNT * SLAB_STAT_COUNT;
+            break;
+        case DUMP_HEAP:
+            words = (int32_t *)conn->vm->heap.stats;
+            words_size = HEAP_STAT_COUNT;
+            break;
+        default:
+            words = NULL;
+            words_size = 0;
+            break;
+    }
+    size = MIN(size, payload_max(conn) / sizeof(words[0]));
+
+    if (start + size <= words_size) {
+        respond(conn, res, &words[start], size * sizeof(words[0]));
     } else {
         printf("Failed to get memory dump\n");
         res->header.status = FAILURE;
@@ -277,13 +822,267 @@ ConnState handle_dump(Conn *conn, Request *req, Response *res)
     return CONN_RES;
 }
 
+// Negotiate the size of the address space in words, the request is
+// rounded up to a power of two and clamped to what the server allows.
+// The memory is cleared and the reply holds the size granted
+ConnState handle_setup(Conn *conn, Request *req, Response *res)
+{
+    printf("SETUP...\n");
+    uint32_t size = MEMORY_SIZE;
+    if (req->header.size >= sizeof(uint32_t)) {
+        size = ((uint32_t *)req->payload)[0];
+    }
+
+    uint32_t max = MAX(server_config.memory_max, MEMORY_SIZE);
+    max = MIN(max, MEMORY_SIZE_MAX);
+    size = MIN(MAX(size, MEMORY_SIZE), max);
+    uint32_t granted = MEMORY_SIZE;
+    while (granted < size)
+        granted <<= 1;
+    if (granted > max)
+        granted >>= 1;
+
+    if (!vm_resize(conn->vm, granted)) {
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    res->header.status = SUCCESS;
+    res->header.size = sizeof(uint32_t);
+    ((uint32_t *)res->payload)[0] = granted;
+    return CONN_RES;
+}
+
+// Agree on the framing, the highest version both sides know. The reply
+// still uses the old one
+ConnState handle_hello(Conn *conn, Request *req, Response *res)
+{
+    printf("HELLO...\n");
+    uint32_t version = 1;
+    if (req->header.size >= sizeof(uint32_t)) {
+        version = ((uint32_t *)req->payload)[0];
+    }
+    version = MIN(MAX(version, 1), PROTOCOL_VERSION);
+
+    // Not in the middle of an upload
+    conn->version = (uint8_t)version;
+    conn->upload_more = false;
+
+    res->header.status = SUCCESS;
+    res->header.size = sizeof(uint32_t);
+    ((uint32_t *)res->payload)[0] = version;
+    return CONN_RES;
+}
+
+// Opt in to DONE after every EXEC, so that clients don't have to poll
+// with DUMP to know when and how their programs ended
+ConnState handle_notify(Conn *conn, Request *req, Response *res)
+{
+    printf("NOTIFY...\n");
+    uint32_t on = 1;
+    if (req->header.size >= sizeof(uint32_t)) {
+        on = ((uint32_t *)req->payload)[0];
+    }
+    conn->notify = on != 0;
+
+    res->header.status = SUCCESS;
+    res->header.size = 0;
+    return CONN_RES;
+}
+
+static void run_free(Conn *conn)
+{
+    conn_buf_free(conn, conn->job);
+    conn->job = NULL;
+}
+
+// Start the VM for the RUN of conn once its program is in, or reply
+// right away with why it can't run. The pokes can't move PC
+static bool run_start(Conn *conn)
+{
+    Vm *vm = conn->vm;
+    Job *job = (Job *)conn->job;
+    RunPoke *pokes = (RunPoke *)job->data;
+    RunRange *ranges = (RunRange *)(pokes + job->args.pokes);
+    uint32_t memory_size = vm_memory_size(vm);
+
+    size_t index = conn->upload_index;
+    InstResult why = conn->upload_why;
+    if (why == OK) {
+        why = exec_prepare(vm, &index);
+    }
+
+    bool valid = true;
+    size_t words = 0;
+    for (uint32_t i = 0; i < job->args.pokes; i++) {
+        valid = valid && pokes[i].address < memory_size && pokes[i].address != PC;
+    }
+    for (uint32_t i = 0; i < job->args.ranges; i++) {
+        valid = valid && ranges[i].start <= memory_size
+            && ranges[i].size <= memory_size - ranges[i].start;
+        words += ranges[i].size;
+    }
+    valid = valid && sizeof(RunResult) + words * sizeof(int32_t) <= FRAME_MAX;
+
+    if (why != OK || !valid) {
+        Response *res = (Response *)conn_wbuf_reserve(conn, sizeof(Response));
+        if (!res) {
+            conn->state = CONN_END;
+            return false;
+        }
+        if (why != OK) {
+            verify_failure(res, index, why);
+        } else {
+            printf("Malformed RUN arguments\n");
+            res->header.status = FAILURE;
+            res->header.size = 0;
+        }
+        conn_wbuf_commit(conn, sizeof(res->header) + res->header.size);
+        run_free(conn);
+        return true;
+    }
+
+    vm_setreg(vm);
+    for (uint32_t i = 0; i < job->args.pokes; i++) {
+        vm->memory[pokes[i].address] = pokes[i].value;
+    }
+    conn->ready = sched_now();
+    conn->started = conn->ready;
+    conn->slices = 0;
+    conn->state = CONN_LOOP;
+    return true;
+}
+
+// Reply to the RUN of conn now that its VM is done
+static void run_reply(Conn *conn)
+{
+    Vm *vm = conn->vm;
+    Job *job = (Job *)conn->job;
+    RunRange *ranges = (RunRange *)((RunPoke *)job->data + job->args.pokes);
+
+    RunResult result = { conn->result, vm->timer };
+    ResponseHeader header = { SUCCESS, sizeof(result) };
+    for (uint32_t i = 0; i < job->args.ranges; i++) {
+        header.size += ranges[i].size * (uint32_t)sizeof(int32_t);
+    }
+
+    bool rv = conn_wbuf_write(conn, &header, sizeof(header))
+        && conn_wbuf_write(conn, &result, sizeof(result));
+    for (uint32_t i = 0; i < job->args.ranges && rv; i++) {
+        rv = conn_wbuf_write(conn, &vm->memory[ranges[i].start],
+                ranges[i].size * sizeof(int32_t));
+    }
+    if (!rv) {
+        conn->state = CONN_END;
+    }
+    run_free(conn);
+}
+
+// Push DONE to conn, its VM stopped
+static void exec_notify(Conn *conn)
+{
+    Vm *vm = conn->vm;
+    struct {
+        ResponseHeader header;
+        ExecDone done;
+    } frame = {
+        { DONE, sizeof(frame.done) },
+        {
+            .elapsed = sched_now() - conn->started,
+            .result = conn->result,
+            .fault = vm->fault,
+            .pc = vm->memory[PC],
+            .r0 = vm->memory[R0],
+            .instructions = vm->timer,
+            .slices = conn->slices,
+        },
+    };
+
+    if (!conn_wbuf_write(conn, &frame, sizeof(frame))) {
+        conn->state = CONN_END;
+    }
+}
+
+// Answer what waited for the VM of conn to stop
+static void finish_vm(Conn *conn)
+{
+    if (conn->job) {
+        run_reply(conn);
+    } else if (conn->notify) {
+        exec_notify(conn);
+    }
+}
+
+// Replace the program with the cached image named by the payload, a
+// failure without payload tells the client to upload it instead. The
+// VM shares the image with the others bound to it until it changes
+// the program. The image is checked again, it may have been cached by
+// a VM with more memory
+ConnState handle_bind(Conn *conn, Request *req, Response *res)
+{
+    printf("BIND...\n");
+    CacheEntry *entry = NULL;
+    if (req->header.size == SHA256_SIZE) {
+        entry = cache_find(&cache, req->payload);
+    }
+    if (!entry) {
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    Image *image = entry->image;
+    Program *program = &image->program;
+    if (!image->code || image->memory_size != vm_memory_size(conn->vm)) {
+        if (!verify_upload(conn->vm, program_data(program), program_size(program), 0, res)) {
+            return CONN_RES;
+        }
+    }
+
+    vm_bind(conn->vm, image);
+    vm_setreg(conn->vm);
+
+    res->header.status = SUCCESS;
+    res->header.size = sizeof(uint32_t);
+    ((uint32_t *)res->payload)[0] = (uint32_t)program_size(program);
+    return CONN_RES;
+}
+
+// Cache the program for BIND, the reply is its digest
+ConnState handle_publish(Conn *conn, Response *res)
+{
+    printf("PUBLISH...\n");
+    Program *program = conn->vm->program;
+    sha256(program_data(program), program_size(program) * sizeof(Instruction), res->payload);
+    CacheEntry *entry = cache_insert(&cache, res->payload, program_data(program), program_size(program));
+    if (!entry) {
+        printf("Failed to cache program\n");
+        res->header.status = FAILURE;
+        res->header.size = 0;
+        return CONN_RES;
+    }
+
+    // Runs the shared copy from now on, the state of the VM is kept
+    vm_bind(conn->vm, entry->image);
+
+    res->header.status = SUCCESS;
+    res->header.size = SHA256_SIZE;
+    return CONN_RES;
+}
+
 bool handle_response(Conn *conn)
 {
-    while (conn->wbuf_sent < conn->wbuf_size) {
-        size_t bytes = 0;
+    while (conn->wbuf_size) {
+        struct iovec iov[WBUF_IOV];
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = (size_t)conn_wbuf_iov(conn, iov, WBUF_IOV),
+        };
+
+        ssize_t bytes = 0;
         do {
-            size_t n = conn->wbuf_size - conn->wbuf_sent;
-            bytes = write(conn->fd, conn->wbuf + conn->wbuf_sent, n);
+            bytes = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
         } while (bytes < 0 && errno == EINTR);
 
         if (bytes < 0) {
@@ -295,111 +1094,535 @@ bool handle_response(Conn *conn)
             break;
         }
 
-        conn->wbuf_sent += (size_t)bytes;
+        conn_wbuf_drop(conn, (size_t)bytes);
+    }
 
-        assert(conn->wbuf_sent <= conn->wbuf_size);
+    // The rest is sent once the socket has room, meanwhile the requests
+    // are only parsed while the queue is short
+    if (conn->state == CONN_REQ || conn->state == CONN_RES) {
+        conn->state = conn->wbuf_size >= WBUF_MAX ? CONN_RES : CONN_REQ;
     }
 
-    conn->wbuf_size = 0;
-    conn->wbuf_sent = 0;
+    return true;
+}
 
-    if (conn->state == CONN_RES) {
+// Run one slice of the scheduler's current quantum, false once the VM
+// is done
+static bool run_slice(Conn *conn)
+{
+    Vm *vm = conn->vm;
+    uint32_t timer = vm->timer;
+    uint64_t start = sched_now();
+    sched_wait(&sched, conn->ready, start);
+
+    vm->slice = sched.stats[SCHED_BUDGET];
+    LoopResult res = loop(vm);
+    conn->result = res;
+    conn->slices++;
+
+    conn->ready = sched_now();
+    sched_ran(&sched, vm->timer - timer, conn->ready - start);
+
+    return res == LR_CONTEXT_CHANGED;
+}
+
+void handle_loop(Conn *conn)
+{
+    if (!run_slice(conn)) {
         conn->state = CONN_REQ;
+        finish_vm(conn);
     }
+}
 
-    return true;
+// Executors have their own scheduler, a slice is planned for the VMs
+// of the executor only
+static void exec_init(void)
+{
+    sched_init(&sched);
+    sched_calibrate(&sched);
 }
 
-void handle_loop(Conn *conn)
+static bool exec_slice(Conn *conn, size_t runnable)
 {
-    switch (loop(conn->vm)) {
-        case LR_CONTEXT_CHANGED:
-            break;
-        case LR_TIME_EXCEEDED:
-        case LR_MALFORMED_INSTRUCTION:
-        case LR_SUCCESS:
-            conn->state = CONN_REQ;
-            break;
+    sched_plan(&sched, runnable, 0);
+    return run_slice(conn);
+}
+
+// Queue a VM that entered CONN_LOOP. Until it is done only the thread
+// running it touches conn->vm, the event loop keeps to the buffers. A
+// VM the executors can't take is answered as aborted, like one that
+// finished on them
+static void run_later(EventLoop *el, Conn *conn)
+{
+    if (pool.size) {
+        if (!pool_submit(&pool, conn)) {
+            conn->result = LR_ABORTED;
+            el_done(el, conn);
+        }
+    } else {
+        el_run_push(el, conn);
     }
 }
 
-void start_server(uint16_t port)
+// Take a connection whose VM is done back to serving requests
+static void finish_epoll(EventLoop *el, Conn *conn)
 {
-    // 0) sigaction()
-    struct sigaction sa;
-    sa.sa_handler = sigquit_handler;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask); // Reset blocked list
-    sigaction(SIGQUIT, &sa, NULL); // Set custom handler
+    conn->state = CONN_REQ;
+    finish_vm(conn);
+    handle_pipelined(conn);
+    if (conn->state == CONN_LOOP) {
+        run_later(el, conn);
+    } else if (conn->state == CONN_END) {
+        el_remove(el, conn->fd);
+    } else {
+        el_update(el, conn);
+    }
+}
+
+static void accept_count(void)
+{
+    uint64_t now = sched_now();
+    if (now - accept_window >= 1000000000) {
+        if (accept_window)
+            accept_stats[ACCEPT_RATE] = (uint32_t)(accept_window_count * 1000000000ull
+                    / (now - accept_window));
+        accept_window = now;
+        accept_window_count = 0;
+    }
+
+    accept_window_count++;
+    accept_stats[ACCEPT_TOTAL]++;
+}
+
+// Out of fds, the connection waiting in the backlog would be reported
+// again and again. Accept it with the fd kept in reserve and close it
+// right away, the client sees the connection reset instead of hanging
+static void accept_shed(void)
+{
+    if (reserve_fd >= 0) {
+        close(reserve_fd);
+        int fd = accept(welcfd, NULL, NULL);
+        if (fd >= 0) {
+            close(fd);
+            accept_stats[ACCEPT_SHED]++;
+            printf("Out of file descriptors, shedding connection\n");
+        }
+        reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+}
+
+// Drain the backlog of the welcome socket, up to accept_batch
+// connections so that the other events get their turn
+static void serve_accept(EventLoop *el)
+{
+    uint32_t accepted = 0;
+    while (accepted < server_config.accept_batch) {
+        int connfd = accept4(welcfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            if (errno == EMFILE || errno == ENFILE) {
+                accept_shed();
+                break;
+            }
+
+            // Connections aborted in the backlog and the like
+            printf("Failed to accept new connection: %s\n", strerror(errno));
+            accept_stats[ACCEPT_FAILURES]++;
+            continue;
+        }
+
+        accepted++;
+        accept_count();
+        if (!el_add(el, connfd)) {
+            close(connfd);
+        }
+    }
+
+    accept_stats[ACCEPT_BATCH_MAX] = MAX(accept_stats[ACCEPT_BATCH_MAX], accepted);
+}
 
+// Readiness based loop, every socket operation is a system call
+static void serve_epoll(EventLoop *el)
+{
+    if (!el_watch(el, welcfd) || !el_watch(el, el->wakefd))
+        die("Failed to set up event loop\n");
+
+    while (1) {
+        // Only check for I/O in passing while VMs are waiting to run
+        int timeout = el->runnable ? 0 : -1;
+        int ready = el_wait(el, timeout);
+        if (ready < 0) {
+            printf("Failed to wait for events\n");
+            ready = 0;
+        }
+
+        size_t pending = 0;
+        for (int i = 0; i < ready; i++) {
+            int fd = el->events[i].data.fd;
+            if (fd == welcfd) {
+                serve_accept(el);
+                continue;
+            }
+
+            if (fd == el->wakefd) {
+                Conn *next;
+                for (Conn *conn = el_take_done(el); conn; conn = next) {
+                    next = conn->next;
+                    pending++;
+                    finish_epoll(el, conn);
+                }
+                continue;
+            }
+
+            Conn *conn = el_get(el, fd);
+            if (!conn) {
+                continue;
+            }
+
+            pending++;
+            if (!handle_connection(conn)) {
+                el_remove(el, fd);
+                continue;
+            }
+
+            el_update(el, conn);
+            if (conn->state == CONN_LOOP) {
+                run_later(el, conn);
+            }
+        }
+
+        // One round, every VM runnable at this point gets a slice
+        sched_plan(&sched, el->runnable, pending);
+        for (size_t n = el->runnable; n > 0; n--) {
+            Conn *conn = el_run_pop(el);
+            if (run_slice(conn)) {
+                el_run_push(el, conn);
+            } else {
+                finish_epoll(el, conn);
+            }
+        }
+    }
+}
+
+// Answer the requests buffered in rbuf until one starts a VM and queue
+// the next socket operation of conn, a send while wbuf holds anything
+// and a receive otherwise. A connection has no more than one of them
+// in flight, so it is only closed once the kernel is done with it
+static void serve_conn(EventLoop *el, Uring *ring, Conn *conn)
+{
+    while (conn->state == CONN_REQ && handle_next(conn)) {
+    }
+
+    bool queued;
+    if (conn->state == CONN_END) {
+        queued = false;
+    } else if (conn->wbuf_size) {
+        queued = uring_send(ring, conn);
+    } else if (conn->state != CONN_REQ) {
+        queued = true;
+    } else if (conn->rbuf_size == BUF_SIZE) {
+        // Nothing could be parsed, there was no buffer for the response
+        queued = false;
+    } else {
+        queued = uring_recv(ring, conn);
+    }
+
+    if (conn->state == CONN_LOOP) {
+        run_later(el, conn);
+    } else if (!queued) {
+        el_remove(el, conn->fd);
+    }
+}
+
+static void finish_uring(EventLoop *el, Uring *ring, Conn *conn)
+{
+    conn->state = CONN_REQ;
+    finish_vm(conn);
+    // Otherwise the send completion takes it from here
+    if (!conn->inflight) {
+        serve_conn(el, ring, conn);
+    }
+}
+
+static void serve_recv(EventLoop *el, Uring *ring, Conn *conn, struct io_uring_cqe *cqe)
+{
+    if (cqe->res == -ENOBUFS) {
+        // Every buffer is taken for now
+        if (!uring_recv(ring, conn))
+            el_remove(el, conn->fd);
+        return;
+    }
+
+    if (cqe->res <= 0) {
+        if (cqe->res < 0)
+            printf("Failed to read from request buffer\n");
+        else if (conn->rbuf_size > 0 || conn->stream_left)
+            printf("Unexpected EOF\n");
+        else
+            printf("EOF\n");
+        uring_recycle(ring, cqe);
+        el_remove(el, conn->fd);
+        return;
+    }
+
+    // Received in place, see uring_recv()
+    if (conn->stream_left) {
+        handle_stream(conn, (size_t)cqe->res);
+        serve_conn(el, ring, conn);
+        return;
+    }
+
+    if (!conn_rbuf(conn)) {
+        uring_recycle(ring, cqe);
+        el_remove(el, conn->fd);
+        return;
+    }
+
+    conn_rbuf_fill(conn, uring_buf(ring, cqe), (size_t)cqe->res);
+    uring_recycle(ring, cqe);
+
+    serve_conn(el, ring, conn);
+}
+
+static void serve_send(EventLoop *el, Uring *ring, Conn *conn, struct io_uring_cqe *cqe)
+{
+    if (cqe->res < 0) {
+        printf("Failed to write to response buffer\n");
+        // A running VM is left to finish, the next receive fails then
+        conn_wbuf_drop(conn, conn->wbuf_size);
+        if (conn->state != CONN_LOOP)
+            el_remove(el, conn->fd);
+        return;
+    }
+
+    conn_wbuf_drop(conn, (size_t)cqe->res);
+    if (conn->wbuf_size) {
+        if (!uring_send(ring, conn) && conn->state != CONN_LOOP)
+            el_remove(el, conn->fd);
+        return;
+    }
+
+    if (conn->state != CONN_LOOP) {
+        serve_conn(el, ring, conn);
+    }
+}
+
+// Completion based loop. Connections are accepted by a multishot
+// request, receives land in the provided buffers of the ring and are
+// copied to rbuf, and all the requests of a round reach the kernel in
+// the one uring_enter() that also waits for the next completions
+static void serve_uring(EventLoop *el, Uring *ring)
+{
+    el->polled = false;
+    if (!uring_accept(ring, welcfd) || !uring_poll(ring, el->wakefd))
+        die("Failed to accept with io_uring\n");
+
+    while (1) {
+        // Only collect completions in passing while VMs are waiting to run
+        if (uring_enter(ring, el->runnable == 0) < 0) {
+            printf("Failed to enter io_uring: %s\n", strerror(errno));
+        }
+
+        size_t pending = 0;
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek(ring))) {
+            int fd = URING_FD(cqe->user_data);
+            UringOp op = URING_OP(cqe->user_data);
+
+            if (op == URING_READY) {
+                if (!uring_accept(ring, welcfd))
+                    die("Failed to accept with io_uring\n");
+                uring_advance(ring);
+                continue;
+            }
+
+            if (op == URING_ACCEPT) {
+                // The fd is taken before the backlog is looked at, accepting
+                // again would fail right away until one is closed. Wait for
+                // the next connection instead, it is shed if still out of fds
+                bool full = cqe->res == -EMFILE || cqe->res == -ENFILE;
+                if (full) {
+                    accept_shed();
+                } else if (cqe->res < 0) {
+                    printf("Failed to accept new connection: %s\n", strerror(-cqe->res));
+                    accept_stats[ACCEPT_FAILURES]++;
+                } else {
+                    accept_count();
+                    if (el_add(el, cqe->res)) {
+                        serve_conn(el, ring, el_get(el, cqe->res));
+                    } else {
+                        close(cqe->res);
+                    }
+                }
+
+                // The kernel ends multishot requests on errors and overflows
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    if (!(full ? uring_ready(ring, welcfd) : uring_accept(ring, welcfd)))
+                        die("Failed to accept with io_uring\n");
+                }
+
+                uring_advance(ring);
+                continue;
+            }
+
+            if (op == URING_WAKE) {
+                Conn *next;
+                for (Conn *conn = el_take_done(el); conn; conn = next) {
+                    next = conn->next;
+                    pending++;
+                    finish_uring(el, ring, conn);
+                }
+
+                if (!(cqe->flags & IORING_CQE_F_MORE) && !uring_poll(ring, el->wakefd))
+                    die("Failed to poll with io_uring\n");
+
+                uring_advance(ring);
+                continue;
+            }
+
+            Conn *conn = el_get(el, fd);
+            if (conn) {
+                pending++;
+                conn->inflight = false;
+                if (op == URING_RECV) {
+                    serve_recv(el, ring, conn, cqe);
+                } else {
+                    serve_send(el, ring, conn, cqe);
+                }
+            }
+            uring_advance(ring);
+        }
+
+        // One round, every VM runnable at this point gets a slice
+        sched_plan(&sched, el->runnable, pending);
+        for (size_t n = el->runnable; n > 0; n--) {
+            Conn *conn = el_run_pop(el);
+            if (run_slice(conn)) {
+                el_run_push(el, conn);
+            } else {
+                finish_uring(el, ring, conn);
+            }
+        }
+    }
+}
+
+// Listening socket of one worker, with more than one they all bind the
+// same port and the kernel spreads the connections between them
+static int open_socket(uint16_t port)
+{
     // 1) socket()
-    welcfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (welcfd < 0)
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
         die("Failed to create welcome socket\n");
 
     int val = 1;
-    setsockopt(welcfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    if (worker_count > 1)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
 
     // 2) bind()
     struct sockaddr_in addr = {0};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
     addr.sin_addr.s_addr = htonl(0);
-    int rv = bind(welcfd, (struct sockaddr *)&addr, sizeof(addr));
+    int rv = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
     if (rv < 0) {
         printf("ERROR STRING: %s\n", strerror(errno));
         die("Failed to bind address to socket\n");
     }
 
     // 3) listen()
-    listen(welcfd, SOMAXCONN);
+    rv = listen(fd, SOMAXCONN);
     if (rv < 0)
         die("Failed to listen from welcome socket\n");
-    else
-        printf("Listening on port %d...\n", port);
 
-    set_nonblocking(welcfd);
+    set_nonblocking(fd);
+    return fd;
+}
+
+// Keep worker id on one CPU, so that its VMs stay in that CPU's caches
+static void pin_worker(uint32_t id)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(id % (uint32_t)cpus, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        printf("Failed to pin worker %u\n", id);
+}
+
+static void *serve(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    welcfd = w->welcfd;
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (server_config.pin)
+        pin_worker(w->id);
+
+    sched_init(&sched);
+    sched_calibrate(&sched);
+    cache_init(&cache, server_config.cache_size);
+    printf("Worker %u calibrated %u ps per instruction\n", w->id,
+            sched.stats[SCHED_PS_PER_INST]);
 
     EventLoop el;
-    el_init(&el);
+    if (!el_init(&el, server_config.hugepages))
+        die("Failed to set up event loop\n");
 
-    // Pollfd Array
-    struct pollfd pa[MAX_CONN];
-    struct pollfd pfd = {welcfd, POLLIN, 0};
-    pa[0] = pfd;
+    Uring ring;
+    if (server_config.uring && uring_init(&ring)) {
+        printf("Worker %u serving with io_uring\n", w->id);
+        serve_uring(&el, &ring);
+    } else {
+        printf("Worker %u serving with epoll\n", w->id);
+        serve_epoll(&el);
+    }
 
-    while (1) {
-        size_t pa_size;
-        if (!el_get_pa(&el, pa, &pa_size)) {
-            printf("Failed to get poll array from event loop\n");
-        }
+    return NULL;
+}
 
-        if (poll(pa, (nfds_t)pa_size, 1000) < 0) {
-            printf("Failed to poll fds\n");
-        }
+void start_server(uint16_t port)
+{
+    // 0) sigaction()
+    struct sigaction sa;
+    sa.sa_handler = sigquit_handler;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask); // Reset blocked list
+    sigaction(SIGQUIT, &sa, NULL); // Set custom handler
 
-        for (size_t i = 1; i < pa_size; i++) {
-            if (pa[i].revents) {
-                int fd = pa[i].fd;
-                Conn *conn = el_get(&el, fd);
-                if (!handle_connection(conn)) {
-                    el_remove(&el, fd);
-                }
-            }
-        }
+    worker_count = MIN(MAX(server_config.workers, 1), WORKERS_MAX);
+    for (uint32_t i = 0; i < worker_count; i++) {
+        workers[i].id = i;
+        workers[i].welcfd = open_socket(port);
+    }
+    printf("Listening on port %d with %u workers (%s range kernels)...\n",
+            port, worker_count, vec_isa());
 
-        if (pa[0].revents) {
-            struct sockaddr_in client_addr = {0};
-            socklen_t socklen = sizeof(client_addr);
-            int connfd = accept(welcfd, (struct sockaddr *)&client_addr, &socklen);
-            if (connfd < 0) {
-                fprintf(stderr, "Failed to accept new connection\n");
-                exit(1);
-            }
+    uint32_t executors = MIN(server_config.executors, POOL_MAX);
+    if (executors) {
+        if (!pool_init(&pool, executors, exec_init, exec_slice))
+            die("Failed to start executors\n");
+        printf("Running VMs on %u executors\n", executors);
+    }
 
-            set_nonblocking(connfd);
+    // A single worker runs on the main thread
+    if (worker_count == 1) {
+        serve(&workers[0]);
+        return;
+    }
 
-            el_add(&el, connfd);
-        }
+    for (uint32_t i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i].thread, NULL, serve, &workers[i]) != 0)
+            die("Failed to start worker\n");
+    }
+    for (uint32_t i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
     }
 }
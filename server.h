@@ -13,13 +13,85 @@ _Static_assert(
 typedef enum {
     MERGE,
     INSERT,
-    EXEC,
+    EXEC, // payload is up to EXEC_ARGS_MAX arguments, see vm_setargs()
     RESET,
     GET,
     DELETE,
     DUMP,
+    SETUP,
+    HELLO, // payload is the framing version asked for, see PROTOCOL_VERSION
+    RUN, // version 2 only, see RunHeader
+    NOTIFY, // payload is 1 to be sent DONE after every EXEC, 0 to stop
+    BIND, // payload is a digest, the program becomes its cached image
+    PUBLISH, // cache the program, the reply is its digest, see cache.h
 } Method;
 
+// Framing of the requests and responses. Connections start with
+// version 1, payloads of up to PAYLOAD_SIZE. Once HELLO agreed on
+// version 2 a MERGE frame carries up to FRAME_MAX bytes, received
+// straight into the program, and GET and DUMP answer with up to as
+// much. A MERGE with FRAME_MORE set in its type goes on in the next
+// frame, the upload is checked and answered as a whole after the last
+#define PROTOCOL_VERSION 2
+#define FRAME_MAX (1 << 16)
+#define FRAME_MORE (1 << 30)
+
+// Upload, execute and dump in one round trip. The payload of RUN is a
+// RunHeader, its pokes and ranges, then the program that replaces the
+// loaded one, if any. Once the registers are reset the pokes are
+// written, the reply comes once the VM is done: a RunResult followed by
+// the words of every range in order
+typedef struct {
+    uint32_t pokes;
+    uint32_t ranges;
+} RunHeader;
+
+typedef struct {
+    uint32_t address;
+    int32_t value;
+} RunPoke;
+
+typedef struct {
+    uint32_t start;
+    uint32_t size; // in words
+} RunRange;
+
+typedef struct {
+    uint32_t result; // enum LoopResult
+    uint32_t instructions; // executed
+} RunResult;
+
+#define EXEC_ARGS_MAX (PAYLOAD_SIZE / sizeof(int32_t))
+
+#define RUN_ARGS_MAX 48 // pokes and ranges of one RUN together
+
+// Words read by DUMP, the request payload is the start and size
+// of the range followed by an optional section (DUMP_MEMORY)
+typedef enum {
+    DUMP_MEMORY,
+    DUMP_FUSION, // how many times each fusion fired, see code.h
+    DUMP_HEAP, // allocator counters, see heap.h
+    DUMP_PAGES, // size of memory in words and pages touched so far
+    DUMP_CFG, // basic blocks, back-edges and exits, see code.h
+    DUMP_SCHED, // scheduler quantum and latency, see sched.h
+    DUMP_SLAB, // slabs of the serving worker by ElSlab, see el.h and slab.h
+    DUMP_ACCEPT, // accept counters of the serving worker, see AcceptStat
+    DUMP_CACHE, // image cache of the serving worker, see cache.h
+    DUMP_JIT, // instructions run as native code and bail outs, see vm.h
+} DumpSection;
+
+#define DUMP_PAGES_SIZE 2
+
+// Counters read by DUMP with the DUMP_ACCEPT section
+typedef enum {
+    ACCEPT_TOTAL, // connections accepted
+    ACCEPT_RATE, // per second, over the last second that saw any
+    ACCEPT_BATCH_MAX, // most accepted for one readiness event
+    ACCEPT_FAILURES, // accept errors other than running out of fds
+    ACCEPT_SHED, // connections closed right away for lack of fds
+    ACCEPT_STAT_COUNT
+} AcceptStat;
+
 typedef struct {
     int32_t type; // enum Method
     uint32_t size;
@@ -39,8 +111,26 @@ typedef enum {
     SUCCESS,
     FAILURE,
     UNKNOWN_METHOD,
+    DONE, // not a reply, pushed once the VM of an EXEC stops, see ExecDone
 } Status;
 
+// Payload of DONE, it comes after the reply to the EXEC and before
+// the replies to the requests that follow it
+typedef struct {
+    uint64_t elapsed; // ns from EXEC to the end, waiting included
+    uint32_t result; // enum LoopResult
+    uint32_t fault; // enum InstResult, OK unless it failed
+    int32_t pc; // memory[PC] at the end, past a faulting instruction
+    int32_t r0;
+    uint32_t instructions; // executed
+    uint32_t slices; // scheduler slices it took
+} ExecDone;
+
+_Static_assert(
+    sizeof(ExecDone) <= PAYLOAD_SIZE,
+    "ExecDone should fit in a version 1 payload"
+);
+
 typedef struct {
     int32_t status; // enum Status
     uint32_t size;
@@ -51,15 +141,39 @@ typedef struct {
     uint8_t payload[PAYLOAD_SIZE];
 } Response;
 
+// Options set on the command line before start_server()
+#define WORKERS_MAX 256
+
+typedef struct {
+    bool jit; // run programs as native code when possible, see jit.h
+    uint32_t memory_max; // largest address space SETUP grants, in words
+    bool uring; // serve sockets with io_uring when available, see uring.h
+    uint32_t workers; // threads serving connections, each on its own socket
+    bool pin; // pin worker i to CPU i
+    uint32_t executors; // threads running the VMs, 0 runs them on the workers
+    bool hugepages; // back the connection slabs with huge pages, see slab.h
+    uint32_t accept_batch; // most connections accepted in one go with epoll
+    uint32_t cache_size; // instructions cached by every worker, see BIND
+} ServerConfig;
+
+extern ServerConfig server_config;
+
 bool handle_connection(Conn *conn);
+bool handle_next(Conn *conn);
 bool handle_request(Conn *conn);
 ConnState handle_merge(Conn *conn, Request *req, Response *res);
 ConnState handle_insert(Conn *conn, Request *req, Response *res);
-ConnState handle_exec(Conn *conn, Response *res);
+ConnState handle_exec(Conn *conn, Request *req, Response *res);
 ConnState handle_reset(Conn *conn, Response *res);
 ConnState handle_get(Conn *conn, Request *req, Response *res);
 ConnState handle_delete(Conn *conn, Request *req, Response *res);
 ConnState handle_dump(Conn *conn, Request *req, Response *res);
+ConnState handle_setup(Conn *conn, Request *req, Response *res);
+ConnState handle_hello(Conn *conn, Request *req, Response *res);
+ConnState handle_notify(Conn *conn, Request *req, Response *res);
+ConnState handle_bind(Conn *conn, Request *req, Response *res);
+ConnState handle_publish(Conn *conn, Response *res);
+bool handle_stream(Conn *conn, size_t bytes);
 bool handle_response(Conn *conn);
 void handle_loop(Conn *conn);
 void start_server(uint16_t port);
@@ -0,0 +1,13 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32 // bytes of a digest
+
+// FIPS 180-4 SHA-256 of size bytes of data, names programs in the
+// image cache, see cache.h
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]);
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+void slab_init(Slab *slab, size_t size, bool huge)
+{
+    // Keep the objects of a slab on separate cache lines
+    slab->size = (size + 63) & ~(size_t)63;
+    slab->huge = huge;
+    slab->free = NULL;
+    slab->next = NULL;
+    slab->end = NULL;
+    memset(slab->stats, 0, sizeof(slab->stats));
+}
+
+static bool slab_grow(Slab *slab)
+{
+    void *arena = MAP_FAILED;
+    if (slab->huge) {
+        arena = mmap(NULL, SLAB_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena != MAP_FAILED)
+            slab->stats[SLAB_HUGE_ARENAS]++;
+    }
+
+    if (arena == MAP_FAILED) {
+        arena = mmap(NULL, SLAB_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) {
+            fprintf(stderr, "Failed to map slab arena\n");
+            return false;
+        }
+        if (slab->huge)
+            madvise(arena, SLAB_ARENA_SIZE, MADV_HUGEPAGE);
+    }
+
+    slab->next = (uint8_t *)arena;
+    slab->end = slab->next + SLAB_ARENA_SIZE / slab->size * slab->size;
+    slab->stats[SLAB_ARENAS]++;
+    return true;
+}
+
+// An object from the free list, or a fresh one if the list is empty.
+// fresh tells which, an object off the free list holds whatever it
+// held when it was freed but its first word
+void *slab_alloc(Slab *slab, bool *fresh)
+{
+    void *ptr = slab->free;
+    *fresh = ptr == NULL;
+    if (ptr) {
+        slab->free = *(void **)ptr;
+        slab->stats[SLAB_FREE]--;
+    } else {
+        if (slab->next == slab->end && !slab_grow(slab))
+            return NULL;
+
+        ptr = slab->next;
+        slab->next += slab->size;
+        slab->stats[SLAB_CARVED]++;
+    }
+
+    slab->stats[SLAB_LIVE]++;
+    return ptr;
+}
+
+void slab_free(Slab *slab, void *ptr)
+{
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+    slab->stats[SLAB_LIVE]--;
+    slab->stats[SLAB_FREE]++;
+}
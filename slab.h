@@ -0,0 +1,39 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SLAB_ARENA_SIZE (2 << 20) // one huge page
+
+// Counters read by DUMP with the DUMP_SLAB section
+typedef enum {
+    SLAB_LIVE, // objects handed out
+    SLAB_FREE, // objects on the free list
+    SLAB_CARVED, // objects ever taken from the arenas
+    SLAB_ARENAS,
+    SLAB_HUGE_ARENAS, // of them backed by reserved huge pages
+    SLAB_STAT_COUNT
+} SlabStat;
+
+// Objects of one size carved out of SLAB_ARENA_SIZE arenas. Freed
+// objects are kept on a free list, which is linked through their first
+// word, and handed out again first. Arenas are never given back. With
+// huge the arenas come from reserved huge pages when there are any,
+// transparent huge pages otherwise. Not thread safe, every event loop
+// has its own
+typedef struct {
+    size_t size; // of an object
+    bool huge;
+    void *free;
+    uint8_t *next; // not carved yet in the last arena
+    uint8_t *end;
+    uint32_t stats[SLAB_STAT_COUNT];
+} Slab;
+
+void slab_init(Slab *slab, size_t size, bool huge);
+void *slab_alloc(Slab *slab, bool *fresh);
+void slab_free(Slab *slab, void *ptr);
+
+#endif
@@ -0,0 +1,87 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+void test_exec_10()
+{
+    const int32_t n = 67;
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        // A = [3] * n at 100, B = (A + A) * A at 200
+        Instruction i0  = { MOVI,    R1, 100 };
+        Instruction i1  = { MOVI,    R2, n };
+        Instruction i2  = { MOVI,    R3, 3 };
+        Instruction i3  = { MSET,    R1, R3, R2 };
+        Instruction i4  = { MOVI,    R3, 200 };
+        Instruction i5  = { MCPY,    R3, R1, R2 };
+        Instruction i6  = { VADD,    R3, R1, R2 };
+        Instruction i7  = { VMUL,    R3, R1, R2 };
+        Instruction i8  = { VSUM,    R0, R3, R2 };
+        Instruction i9  = { MOVI,    20, n };
+        Instruction i10 = { VDOT,    20, R1, R3 };
+        Instruction i11 = { MOVI,    21, n };
+        Instruction i12 = { VCMP,    21, R3, R3 };
+        Instruction i13 = { VMAX,    22, R3, R2 };
+        Instruction i14 = { VMIN,    23, R1, R2 };
+        Instruction i15 = { HALT };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+        program_add(&program, i3);
+        program_add(&program, i4);
+        program_add(&program, i5);
+        program_add(&program, i6);
+        program_add(&program, i7);
+        program_add(&program, i8);
+        program_add(&program, i9);
+        program_add(&program, i10);
+        program_add(&program, i11);
+        program_add(&program, i12);
+        program_add(&program, i13);
+        program_add(&program, i14);
+        program_add(&program, i15);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        char *error = NULL;
+
+        int32_t memory[24];
+        client_dump(fd, memory, 24);
+        if (memory[R0] != 18 * n)
+            error = "Range sum does not match";
+        else if (memory[20] != 3 * 18 * n)
+            error = "Range dot product does not match";
+        else if (memory[21] != n)
+            error = "Equal ranges compared different";
+        else if (memory[22] != 18 || memory[23] != 3)
+            error = "Range max or min does not match";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 10);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
@@ -0,0 +1,67 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../code.h"
+#include "tests.h"
+
+void test_exec_11()
+{
+    // The loop body is a single block of 3 instructions, the time limit
+    // lands right after the first one of an iteration
+    const int32_t executed = TIMER_LIMIT + 1;
+    const int32_t iterations = executed / 3 + 1;
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        Instruction i0 = { ADDI,    R0, R0, 1 };
+        Instruction i1 = { ADDI,    R1, R1, 2 };
+        Instruction i2 = { B,       0 };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        char *error = NULL;
+
+        int32_t memory[PC + 1];
+        client_dump(fd, memory, PC + 1);
+        if (memory[R0] != iterations
+            || memory[R1] != 2 * (iterations - 1)
+            || memory[PC] != 1)
+            error = "Timed out on a different instruction";
+
+        int32_t cfg[CFG_STAT_COUNT];
+        client_dump_section(fd, DUMP_CFG, cfg, CFG_STAT_COUNT);
+        if (cfg[CFG_BLOCKS] != 1
+            || cfg[CFG_BACK_EDGES] != 1
+            || cfg[CFG_EXITS] != 0)
+            error = "Unexpected control-flow graph";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 11);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
@@ -0,0 +1,64 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../sched.h"
+#include "tests.h"
+
+void test_exec_12()
+{
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        // Runs until the time limit, alone it should only take a
+        // handful of slices instead of one every CONTEXT_SIZE
+        Instruction i0 = { ADDI,    R0, R0, 1 };
+        Instruction i1 = { MUL,     R1, R0, R0 };
+        Instruction i2 = { B,       0 };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        char *error = NULL;
+
+        int32_t memory;
+        client_dump(fd, &memory, 1);
+        if (memory != (TIMER_LIMIT + 1) / 3 + 1)
+            error = "Program did not run up to the time limit";
+
+        int32_t stats[SCHED_STAT_COUNT];
+        client_dump_section(fd, DUMP_SCHED, stats, SCHED_STAT_COUNT);
+        if (stats[SCHED_SLICES] < 1 || stats[SCHED_SLICES] > 64)
+            error = "Unexpected number of slices";
+        if (stats[SCHED_PS_PER_INST] <= 0
+            || stats[SCHED_BUDGET] < CONTEXT_SIZE
+            || stats[SCHED_LATENCY_AVG] > stats[SCHED_LATENCY_MAX])
+            error = "Unexpected scheduler counters";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 12);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
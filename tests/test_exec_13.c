@@ -0,0 +1,70 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+// Same as the other tests but served through epoll, with two
+// connections executing at the same time
+void test_exec_13()
+{
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fds[2] = { connect_server(PORT), connect_server(PORT) };
+        const int32_t n[2] = { 5, 10 };
+
+        for (int c = 0; c < 2; c++) {
+            Program program;
+            program_init(&program);
+
+            Instruction i0 = { MOVI,    R1, n[c] };
+            Instruction i1 = { MOV,     R0, R1 };
+            Instruction i2 = { SUBI,    R1, R1, 1 };
+            Instruction i3 = { BEQI,    6, R1, 1 };
+            Instruction i4 = { MUL,     R0, R0, R1 };
+            Instruction i5 = { B,       2 };
+            Instruction i6 = { HALT };
+
+            program_add(&program, i0);
+            program_add(&program, i1);
+            program_add(&program, i2);
+            program_add(&program, i3);
+            program_add(&program, i4);
+            program_add(&program, i5);
+            program_add(&program, i6);
+
+            client_merge_all(fds[c], &program);
+            program_deinit(&program);
+        }
+
+        client_exec(fds[0]);
+        client_exec(fds[1]);
+
+        char *error = NULL;
+        for (int c = 0; c < 2; c++) {
+            int32_t memory;
+            client_dump(fds[c], &memory, 1);
+            if (memory != factorial(n[c]))
+                error = "Expected factorial calculation does not match";
+        }
+
+        // Clean
+        close(fds[0]);
+        close(fds[1]);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+
+        // Check error
+        check_error(error, 13);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = false;
+        start_server(PORT);
+    }
+}
@@ -0,0 +1,78 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+#define CONNS 8
+
+// Connections spread over several workers, each should behave as if it
+// had the server to itself
+void test_exec_14()
+{
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fds[CONNS];
+        int32_t n[CONNS];
+        for (int c = 0; c < CONNS; c++) {
+            fds[c] = connect_server(PORT);
+            n[c] = 3 + c;
+        }
+
+        for (int c = 0; c < CONNS; c++) {
+            Program program;
+            program_init(&program);
+
+            Instruction i0 = { MOVI,    R1, n[c] };
+            Instruction i1 = { MOV,     R0, R1 };
+            Instruction i2 = { SUBI,    R1, R1, 1 };
+            Instruction i3 = { BEQI,    6, R1, 1 };
+            Instruction i4 = { MUL,     R0, R0, R1 };
+            Instruction i5 = { B,       2 };
+            Instruction i6 = { HALT };
+
+            program_add(&program, i0);
+            program_add(&program, i1);
+            program_add(&program, i2);
+            program_add(&program, i3);
+            program_add(&program, i4);
+            program_add(&program, i5);
+            program_add(&program, i6);
+
+            client_merge_all(fds[c], &program);
+            program_deinit(&program);
+        }
+
+        for (int c = 0; c < CONNS; c++) {
+            client_exec(fds[c]);
+        }
+
+        char *error = NULL;
+        for (int c = 0; c < CONNS; c++) {
+            int32_t memory;
+            client_dump(fds[c], &memory, 1);
+            if (memory != factorial(n[c]))
+                error = "Expected factorial calculation does not match";
+        }
+
+        // Clean
+        for (int c = 0; c < CONNS; c++) {
+            close(fds[c]);
+        }
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+
+        // Check error
+        check_error(error, 14);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        server_config.workers = 4;
+        start_server(PORT);
+    }
+}
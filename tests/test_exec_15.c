@@ -0,0 +1,101 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../utils.h"
+#include "tests.h"
+
+// VMs run on executors next to a long one, a DUMP sent together with
+// its EXEC has to see the result
+void test_exec_15()
+{
+    const int32_t n = 6;
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int slow = connect_server(PORT);
+        int fast = connect_server(PORT);
+
+        Program program_1;
+        Program program_2;
+        program_init(&program_1);
+        program_init(&program_2);
+
+        Instruction i0 = { ADDI,    R0, R0, 1 };
+        Instruction i1 = { B,       0 };
+
+        program_add(&program_1, i0);
+        program_add(&program_1, i1);
+
+        Instruction j0 = { MOVI,    R1, n };
+        Instruction j1 = { MOV,     R0, R1 };
+        Instruction j2 = { SUBI,    R1, R1, 1 };
+        Instruction j3 = { BEQI,    6, R1, 1 };
+        Instruction j4 = { MUL,     R0, R0, R1 };
+        Instruction j5 = { B,       2 };
+        Instruction j6 = { HALT };
+
+        program_add(&program_2, j0);
+        program_add(&program_2, j1);
+        program_add(&program_2, j2);
+        program_add(&program_2, j3);
+        program_add(&program_2, j4);
+        program_add(&program_2, j5);
+        program_add(&program_2, j6);
+
+        client_merge_all(slow, &program_1);
+        client_merge_all(fast, &program_2);
+        client_exec(slow);
+
+        // EXEC and DUMP in one write
+        struct {
+            RequestHeader exec;
+            RequestHeader dump;
+            uint32_t args[3];
+        } __attribute__((packed)) reqs = {
+            { EXEC, 0 },
+            { DUMP, sizeof(reqs.args) },
+            { 0, 1, DUMP_MEMORY },
+        };
+        write_all(fast, &reqs, sizeof(reqs));
+
+        char *error = NULL;
+        Response res;
+        read_all(fast, &res, sizeof(res.header));
+        read_all(fast, res.payload, res.header.size);
+        if (res.header.status != SUCCESS)
+            error = "EXEC failed";
+
+        read_all(fast, &res, sizeof(res.header));
+        read_all(fast, res.payload, res.header.size);
+        if (res.header.status != SUCCESS || res.header.size != sizeof(int32_t)
+            || *(int32_t *)res.payload != factorial(n))
+            error = "DUMP did not wait for EXEC";
+
+        int32_t memory;
+        client_dump(slow, &memory, 1);
+        if (memory != (TIMER_LIMIT + 1) / 2)
+            error = "Long program did not run up to the time limit";
+
+        // Clean
+        close(slow);
+        close(fast);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program_1);
+        program_deinit(&program_2);
+
+        // Check error
+        check_error(error, 15);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        server_config.executors = 2;
+        start_server(PORT);
+    }
+}
@@ -0,0 +1,117 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../el.h"
+#include "tests.h"
+
+#define SLAB_SETUP (1 << 20) // words granted to the large VM
+#define SLAB_TOUCHED 900 // pages it writes to
+
+// A closed connection is recycled by the next one, which should not
+// see anything of it
+void test_exec_16()
+{
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        Instruction i0 = { MOVI,    100, 42 };
+        Instruction i1 = { HALT };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        char *error = NULL;
+        int32_t memory[101];
+        client_dump(fd, memory, 101);
+        if (memory[100] != 42)
+            error = "Program did not run";
+
+        close(fd);
+        usleep(10000);
+        fd = connect_server(PORT);
+
+        client_dump(fd, memory, 101);
+        if (memory[100] != 0)
+            error = "Memory of the previous connection is visible";
+
+        program_clear(&program);
+        client_get_all(fd, &program);
+        if (program_size(&program) != 0)
+            error = "Program of the previous connection is visible";
+
+        int32_t stats[EL_SLAB_COUNT][SLAB_STAT_COUNT];
+        client_dump_section(fd, DUMP_SLAB, &stats[0][0], EL_SLAB_COUNT * SLAB_STAT_COUNT);
+        for (int i = EL_SLAB_CONN; i <= EL_SLAB_VM; i++) {
+            if (stats[i][SLAB_LIVE] != 1 || stats[i][SLAB_CARVED] != 1
+                || stats[i][SLAB_FREE] != 0 || stats[i][SLAB_ARENAS] != 1)
+                error = "Connection was not recycled";
+        }
+
+        // A closed VM gives back the memory it grew to, even though
+        // its slot is kept
+        long before = rss_of(pid);
+        int large = connect_server(PORT);
+        uint32_t size = SLAB_SETUP;
+        client_setup(large, &size);
+
+        Program touch;
+        program_init(&touch);
+        Instruction t0 = { MOVI,    R1, 4096 };
+        Instruction t1 = { MOVI,    R2, SLAB_TOUCHED };
+        Instruction t2 = { STORE,   R1, R2, 0 };
+        Instruction t3 = { ADDI,    R1, R1, 1024 }; // a page further
+        Instruction t4 = { SUBI,    R2, R2, 1 };
+        Instruction t5 = { BNEI,    2, R2, 0 };
+        Instruction t6 = { HALT };
+        program_add(&touch, t0);
+        program_add(&touch, t1);
+        program_add(&touch, t2);
+        program_add(&touch, t3);
+        program_add(&touch, t4);
+        program_add(&touch, t5);
+        program_add(&touch, t6);
+        client_merge_all(large, &touch);
+        client_exec(large);
+        program_deinit(&touch);
+
+        int32_t pages[DUMP_PAGES_SIZE];
+        client_dump_section(large, DUMP_PAGES, pages, DUMP_PAGES_SIZE);
+        if (size != SLAB_SETUP || pages[1] < SLAB_TOUCHED)
+            error = "Large VM did not touch its memory";
+
+        close(large);
+        long after = rss_of(pid);
+        for (int i = 0; i < 1000 && after - before > SLAB_TOUCHED * 4 / 2; i++) {
+            usleep(1000);
+            after = rss_of(pid);
+        }
+        if (after - before > SLAB_TOUCHED * 4 / 2)
+            error = "Closed VM kept its memory";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 16);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+#define IDLE_CONNS 5000
+#define IDLE_WARM 100 // opened before measuring, they set up the slab arenas
+
+// Wait for the server to accept at least count connections
+static bool wait_accepted(int fd, int32_t count)
+{
+    for (int tries = 0; tries < 3000; tries++) {
+        int32_t stats[EL_SLAB_COUNT][SLAB_STAT_COUNT];
+        client_dump_section(fd, DUMP_SLAB, &stats[0][0], EL_SLAB_COUNT * SLAB_STAT_COUNT);
+        if (stats[EL_SLAB_CONN][SLAB_LIVE] >= count)
+            return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+// Open IDLE_CONNS connections that never send anything and report what
+// they cost the server
+void test_exec_17()
+{
+    // Both ends need an fd per connection, the server inherits this
+    int count = IDLE_WARM + IDLE_CONNS;
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)count + 64) {
+        limit.rlim_cur = limit.rlim_max;
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max > (rlim_t)count + 64)
+            limit.rlim_cur = count + 64;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        char *error = NULL;
+
+        int control = connect_server(PORT);
+        int *fds = malloc(count * sizeof(int));
+        int opened = 0;
+        while (opened < IDLE_WARM && (fds[opened] = connect_server(PORT)) >= 0) {
+            opened++;
+        }
+        if (!wait_accepted(control, opened + 1))
+            error = "Control connection was not accepted";
+        long before = rss_of(pid);
+
+        while (opened < count && (fds[opened] = connect_server(PORT)) >= 0) {
+            opened++;
+        }
+
+        if (!wait_accepted(control, opened + 1))
+            error = "Idle connections were not accepted";
+        long after = rss_of(pid);
+
+        long per_conn = (after - before) * 1024 / IDLE_CONNS;
+        printf("Test 17: %d idle connections, server RSS %ld kB -> %ld kB, %ld bytes each\n",
+                IDLE_CONNS, before, after, per_conn);
+        if (opened < count)
+            error = "Too few connections opened";
+        else if (before < 0 || after < 0)
+            error = "Failed to read server RSS";
+        else if (per_conn > 512)
+            error = "Idle connections take too much memory";
+
+        // Clean
+        for (int i = 0; i < opened; i++) {
+            close(fds[i]);
+        }
+        free(fds);
+        close(control);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+
+        // Check error
+        check_error(error, 17);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
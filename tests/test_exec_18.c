@@ -0,0 +1,98 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+#define STORM_FDS 32 // fd limit of the server
+#define STORM_CONNS 64
+
+static void storm_accept_stats(int fd, int32_t *stats)
+{
+    client_dump_section(fd, DUMP_ACCEPT, stats, ACCEPT_STAT_COUNT);
+}
+
+// More connections than the server has fds for, the extra ones should
+// be shed and the server keep serving
+static char *storm(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        struct rlimit limit = { STORM_FDS, STORM_FDS };
+        setrlimit(RLIMIT_NOFILE, &limit);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    int32_t stats[ACCEPT_STAT_COUNT];
+
+    int control = connect_server(PORT);
+    storm_accept_stats(control, stats);
+    if (stats[ACCEPT_TOTAL] != 1)
+        error = "Control connection was not counted";
+
+    int fds[STORM_CONNS];
+    for (int i = 0; i < STORM_CONNS; i++) {
+        fds[i] = connect_server(PORT);
+    }
+
+    for (int tries = 0; tries < 100; tries++) {
+        storm_accept_stats(control, stats);
+        if (stats[ACCEPT_TOTAL] + stats[ACCEPT_SHED] == STORM_CONNS + 1)
+            break;
+        usleep(10000);
+    }
+    if (stats[ACCEPT_SHED] == 0 || stats[ACCEPT_TOTAL] >= STORM_FDS)
+        error = "Connections beyond the fd limit were not shed";
+    if (stats[ACCEPT_TOTAL] + stats[ACCEPT_SHED] != STORM_CONNS + 1)
+        error = "Connections went missing";
+    if (stats[ACCEPT_FAILURES] != 0)
+        error = "Unexpected accept failures";
+
+    for (int i = 0; i < STORM_CONNS; i++) {
+        close(fds[i]);
+    }
+    usleep(10000);
+
+    // There are fds again
+    int fd = connect_server(PORT);
+    Program program;
+    program_init(&program);
+    Instruction i0 = { MOVI,    R0, 7 };
+    program_add(&program, i0);
+    client_merge_all(fd, &program);
+    client_exec(fd);
+    int32_t memory;
+    client_dump(fd, &memory, 1);
+    if (memory != 7)
+        error = "Server stopped serving after the storm";
+
+    // Clean
+    close(fd);
+    close(control);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&program);
+    return error;
+}
+
+void test_exec_18()
+{
+    // Shed connections are reset, don't die writing to them
+    signal(SIGPIPE, SIG_IGN);
+    char *error = storm(true);
+    if (!error)
+        error = storm(false);
+
+    // Check error
+    check_error(error, 18);
+}
@@ -0,0 +1,125 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../utils.h"
+#include "tests.h"
+
+#define RING_REQS 64
+
+// Requests of a size that doesn't divide BUF_SIZE, written at once so
+// that some of them wrap around the end of rbuf
+static char *ring(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    int fd = connect_server(PORT);
+
+    struct {
+        RequestHeader header;
+        Instruction inst;
+    } __attribute__((packed)) reqs[RING_REQS];
+    for (int i = 0; i < RING_REQS; i++) {
+        reqs[i].header = (RequestHeader) { MERGE, sizeof(Instruction) };
+        reqs[i].inst = (Instruction) { ADDI, R0, R0, 1 };
+    }
+    reqs[RING_REQS - 1].inst = (Instruction) { HALT };
+    write_all(fd, reqs, sizeof(reqs));
+
+    Response res;
+    for (int i = 0; i < RING_REQS; i++) {
+        read_all(fd, &res, sizeof(res.header));
+        read_all(fd, res.payload, res.header.size);
+        if (res.header.status != SUCCESS)
+            error = "Pipelined MERGE failed";
+    }
+
+    client_exec(fd);
+    int32_t memory;
+    client_dump(fd, &memory, 1);
+    if (memory != RING_REQS - 1)
+        error = "Requests were lost or reordered in rbuf";
+
+    // A payload of odd size leaves the requests after it misaligned
+    struct {
+        RequestHeader notify;
+        uint32_t off;
+        uint8_t pad;
+        RequestHeader insert;
+        uint64_t start;
+        uint64_t size;
+        Instruction inst;
+        RequestHeader exec;
+        RequestHeader dump;
+        uint32_t args[2];
+    } __attribute__((packed)) odd = {
+        { NOTIFY, sizeof(uint32_t) + 1 }, 0, 0,
+        { INSERT, 2 * sizeof(uint64_t) + sizeof(Instruction) }, 0, 1, { MOVI, R0, 7 },
+        { EXEC, 0 },
+        { DUMP, sizeof(odd.args) }, { R0, 1 },
+    };
+    write_all(fd, &odd, sizeof(odd));
+    for (int i = 0; i < 4; i++) {
+        read_all(fd, &res, sizeof(res.header));
+        read_all(fd, res.payload, res.header.size);
+        if (res.header.status != SUCCESS)
+            error = "Misaligned request failed";
+    }
+    if (((int32_t *)res.payload)[0] != 7 + RING_REQS - 1)
+        error = "Misaligned request was misread";
+
+    // Requests without their arguments don't read those of the next
+    struct {
+        RequestHeader get;
+        RequestHeader del;
+        RequestHeader dump;
+        uint32_t args[2];
+    } __attribute__((packed)) empty = {
+        { GET, 0 },
+        { DELETE, 0 },
+        { DUMP, sizeof(empty.args) }, { R0, 1 },
+    };
+    write_all(fd, &empty, sizeof(empty));
+    for (int i = 0; i < 3; i++) {
+        read_all(fd, &res, sizeof(res.header));
+        read_all(fd, res.payload, res.header.size);
+        if (i < 2 && res.header.status != FAILURE)
+            error = "Request without arguments read the next one";
+    }
+    if (res.header.status != SUCCESS || ((int32_t *)res.payload)[0] != 7 + RING_REQS - 1)
+        error = "Request without arguments changed the program";
+
+    // A payload larger than any request closes the connection
+    RequestHeader large = { MERGE, BUF_SIZE };
+    write_all(fd, &large, sizeof(large));
+    if (read(fd, &res, sizeof(res.header)) > 0)
+        error = "Request too large was not refused";
+
+    // Clean
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    return error;
+}
+
+void test_exec_19()
+{
+    char *error = ring(true);
+    if (!error)
+        error = ring(false);
+
+    // Check error
+    check_error(error, 19);
+}
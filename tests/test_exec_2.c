@@ -17,12 +17,7 @@ void test_exec_2()
     int pid = fork();
     if (pid) {
         usleep(1000);
-        int fd = socket(AF_INET, SOCK_STREAM, 0);
-        struct sockaddr_in addr = {0};
-        addr.sin_family = AF_INET;
-        addr.sin_port = ntohs(PORT);
-        addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
-        connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        int fd = connect_server(PORT);
 
         Program program_1;
         Program program_2;
@@ -82,6 +77,7 @@ void test_exec_2()
         // Clean
         close(fd);
         kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
         program_deinit(&program_1);
         program_deinit(&program_2);
 
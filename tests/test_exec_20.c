@@ -0,0 +1,94 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../utils.h"
+#include "tests.h"
+
+#define QUEUE_BASE 64 // past the registers
+#define QUEUE_WORDS 8 // a full payload per DUMP
+#define QUEUE_REQS 200000
+
+// A deep pipeline read only once it is all written, the responses have
+// to queue up, wait for the client and still come back in order
+static char *queue(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+
+    // Fills up long before the responses are read
+    int fd = connect_server_rcvbuf(PORT, 1024);
+
+    Program program;
+    program_init(&program);
+    for (uint32_t i = 0; i < QUEUE_WORDS; i++) {
+        Instruction inst = { MOVI, QUEUE_BASE + i, i };
+        program_add(&program, inst);
+    }
+    Instruction halt = { HALT };
+    program_add(&program, halt);
+    client_merge_all(fd, &program);
+    client_exec(fd);
+
+    typedef struct {
+        RequestHeader header;
+        uint32_t args[3];
+    } __attribute__((packed)) Dump;
+    static Dump reqs[QUEUE_REQS];
+    for (uint32_t i = 0; i < QUEUE_REQS; i++) {
+        reqs[i] = (Dump) {
+            { DUMP, sizeof(reqs[i].args) },
+            { QUEUE_BASE, QUEUE_WORDS, DUMP_MEMORY },
+        };
+    }
+    // Written from another process, the server stops reading at some
+    // point and waits for the responses to be read
+    int writer = fork();
+    if (!writer) {
+        write_all(fd, reqs, sizeof(reqs));
+        _exit(0);
+    }
+    usleep(50000);
+
+    Response res;
+    for (uint32_t i = 0; i < QUEUE_REQS && !error; i++) {
+        read_all(fd, &res, sizeof(res.header));
+        read_all(fd, res.payload, res.header.size);
+        if (res.header.status != SUCCESS || res.header.size != QUEUE_WORDS * sizeof(int32_t))
+            error = "Pipelined DUMP failed";
+        for (int32_t j = 0; j < QUEUE_WORDS && !error; j++) {
+            if (((int32_t *)res.payload)[j] != j)
+                error = "Responses were lost or corrupted";
+        }
+    }
+
+    // Clean
+    waitpid(writer, NULL, 0);
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&program);
+    return error;
+}
+
+void test_exec_20()
+{
+    char *error = queue(true);
+    if (!error)
+        error = queue(false);
+
+    // Check error
+    check_error(error, 20);
+}
@@ -0,0 +1,92 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+#define FRAMES_SIZE 100000 // instructions, many frames of version 2
+#define FRAMES_BAD 5000 // upload rejected in its second frame
+
+// A large program uploaded and read back in version 2 frames, a bad
+// instruction in one frame undoes the whole upload
+static char *frames(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    int fd = connect_server(PORT);
+
+    if (client_hello(fd, PROTOCOL_VERSION) != 2)
+        error = "Version 2 was not agreed on";
+
+    // Jumps over the filler to the end
+    Program program;
+    program_init(&program);
+    Instruction jump = { B, FRAMES_SIZE - 2 };
+    program_add(&program, jump);
+    for (uint32_t i = 1; i < FRAMES_SIZE - 2; i++) {
+        Instruction filler = { MOVI, R1, i };
+        program_add(&program, filler);
+    }
+    Instruction set = { MOVI, R0, 42 };
+    Instruction halt = { HALT };
+    program_add(&program, set);
+    program_add(&program, halt);
+
+    if (!client_upload(fd, &program))
+        error = "Upload failed";
+
+    client_exec(fd);
+    int32_t memory[MEMORY_SIZE];
+    if (!client_dump(fd, memory, MEMORY_SIZE) || memory[R0] != 42)
+        error = "Uploaded program did not run";
+
+    Program bad;
+    program_init(&bad);
+    for (uint32_t i = 0; i < FRAMES_BAD; i++) {
+        Instruction inst = { MOVI, i == FRAMES_BAD - 1 ? MEMORY_SIZE : R1, i };
+        program_add(&bad, inst);
+    }
+    if (client_upload(fd, &bad))
+        error = "Bad upload was accepted";
+
+    Program fetched;
+    program_init(&fetched);
+    client_get_all(fd, &fetched);
+    if (program_size(&fetched) != FRAMES_SIZE)
+        error = "Program size changed";
+    for (size_t i = 0; i < program_size(&fetched) && !error; i++) {
+        if (!inst_eq(program_fetch(&fetched, i), program_fetch(&program, i)))
+            error = "Program read back does not match";
+    }
+
+    // Clean
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&program);
+    program_deinit(&bad);
+    program_deinit(&fetched);
+    return error;
+}
+
+void test_exec_21()
+{
+    char *error = frames(true);
+    if (!error)
+        error = frames(false);
+
+    // Check error
+    check_error(error, 21);
+}
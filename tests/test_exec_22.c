@@ -0,0 +1,90 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../vm.h"
+#include "tests.h"
+
+#define RUN_SUM 100 // where the program leaves its sum
+
+// Upload, run and dump in one request, then run the same program again
+// from other initial values
+static char *run(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    int fd = connect_server(PORT);
+    client_hello(fd, PROTOCOL_VERSION);
+
+    // Sum of R2 down to 1
+    Program program;
+    program_init(&program);
+    Instruction insts[] = {
+        { ADD, R1, R1, R2 },
+        { SUBI, R2, R2, 1 },
+        { BNEI, 0, R2, 0 },
+        { MOV, RUN_SUM, R1 },
+        { HALT },
+    };
+    for (size_t i = 0; i < sizeof(insts) / sizeof(insts[0]); i++) {
+        program_add(&program, insts[i]);
+    }
+
+    RunPoke poke = { R2, 10 };
+    RunRange ranges[] = { { R1, 2 }, { RUN_SUM, 1 } };
+    RunResult result;
+    int32_t words[3];
+    if (!client_run(fd, &program, &poke, 1, ranges, 2, &result, words))
+        error = "RUN failed";
+    else if (result.result != LR_SUCCESS || result.instructions != 3 * 10 + 2)
+        error = "RUN did not report how the program ended";
+    else if (words[0] != 55 || words[1] != 0 || words[2] != 55)
+        error = "RUN returned the wrong memory";
+
+    // The program stays loaded
+    poke.value = 100;
+    if (!client_run(fd, NULL, &poke, 1, &ranges[1], 1, &result, words) || words[0] != 5050)
+        error = "RUN of the loaded program failed";
+
+    poke.value = TIMER_LIMIT;
+    if (!client_run(fd, NULL, &poke, 1, NULL, 0, &result, words)
+            || result.result != LR_TIME_EXCEEDED)
+        error = "RUN did not report the time limit";
+
+    RunPoke bad = { MEMORY_SIZE, 1 };
+    if (client_run(fd, NULL, &bad, 1, NULL, 0, &result, words))
+        error = "RUN with a poke out of memory was accepted";
+
+    int32_t sum;
+    if (!client_dump_section(fd, DUMP_MEMORY, &sum, 1) || sum != 0)
+        error = "Connection is out of sync after RUN";
+
+    // Clean
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&program);
+    return error;
+}
+
+void test_exec_22()
+{
+    char *error = run(true);
+    if (!error)
+        error = run(false);
+
+    // Check error
+    check_error(error, 22);
+}
@@ -0,0 +1,91 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../vm.h"
+#include "../utils.h"
+#include "tests.h"
+
+// Replace the program of fd with insts and run it
+static bool notify_exec(int fd, Instruction *insts, size_t n)
+{
+    Program program;
+    program_init(&program);
+    for (size_t i = 0; i < n; i++) {
+        program_add(&program, insts[i]);
+    }
+
+    Request req = { { RESET, 0 } };
+    Response res;
+    write_all(fd, &req, sizeof(req.header));
+    read_all(fd, &res, sizeof(res.header));
+    bool rv = client_merge_all(fd, &program) && client_exec(fd);
+
+    program_deinit(&program);
+    return rv;
+}
+
+// The three ways a VM stops are told apart by DONE, and nothing is
+// pushed once the client opted out
+static char *notify(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    int fd = connect_server(PORT);
+    if (!client_notify(fd, true))
+        error = "NOTIFY failed";
+
+    ExecDone done;
+    Instruction ok[] = { { MOVI, R0, 7 }, { HALT } };
+    if (!notify_exec(fd, ok, 2) || !client_done(fd, &done))
+        error = "No DONE after EXEC";
+    else if (done.result != LR_SUCCESS || done.fault != OK || done.r0 != 7
+            || done.instructions != 2 || done.slices < 1)
+        error = "DONE of a program that halted is wrong";
+
+    Instruction fault[] = { { MOVI, R0, 3 }, { DIV, R1, R0, R2 }, { HALT } };
+    if (!notify_exec(fd, fault, 3) || !client_done(fd, &done))
+        error = "No DONE after a fault";
+    else if (done.result != LR_MALFORMED_INSTRUCTION || done.fault != DIVISION_BY_ZERO
+            || done.r0 != 3 || done.pc != 2)
+        error = "DONE of a program that faulted is wrong";
+
+    Instruction spin[] = { { B, 0 } };
+    if (!notify_exec(fd, spin, 1) || !client_done(fd, &done))
+        error = "No DONE after a timeout";
+    else if (done.result != LR_TIME_EXCEEDED || done.instructions <= TIMER_LIMIT)
+        error = "DONE of a program that ran out of time is wrong";
+
+    client_notify(fd, false);
+    int32_t r0;
+    if (!notify_exec(fd, ok, 2) || !client_dump(fd, &r0, 1) || r0 != 7)
+        error = "DONE was pushed after opting out";
+
+    // Clean
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    return error;
+}
+
+void test_exec_23()
+{
+    char *error = notify(true);
+    if (!error)
+        error = notify(false);
+
+    // Check error
+    check_error(error, 23);
+}
@@ -0,0 +1,92 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../vm.h"
+#include "tests.h"
+
+#define ARGS_RUNS 100
+
+// One upload run many times on arguments passed in the registers and
+// on the stack
+static char *args(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    int fd = connect_server(PORT);
+
+    // R0 + R1 * R2 - R3 + the first pushed - the second
+    Program program;
+    program_init(&program);
+    Instruction insts[] = {
+        { MUL, R1, R1, R2 },
+        { ADD, R0, R0, R1 },
+        { SUB, R0, R0, R3 },
+        { POP, R1 },
+        { SUB, R0, R0, R1 },
+        { POP, R1 },
+        { ADD, R0, R0, R1 },
+        { HALT },
+    };
+    size_t n = sizeof(insts) / sizeof(insts[0]);
+    for (size_t i = 0; i < n; i++) {
+        program_add(&program, insts[i]);
+    }
+    client_merge_all(fd, &program);
+
+    for (int32_t i = 0; i < ARGS_RUNS && !error; i++) {
+        int32_t argv[EXEC_ARGS_MAX] = { i, 2, i, 1, 1000, i };
+        int32_t r0;
+        if (!client_exec_args(fd, argv, 6) || !client_dump(fd, &r0, 1))
+            error = "EXEC with arguments failed";
+        else if (r0 != i + 2 * i - 1 + 1000 - i)
+            error = "Arguments were not passed";
+    }
+
+    // Only the last two pushed are popped
+    int32_t full[EXEC_ARGS_MAX] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    int32_t regs[SB];
+    if (!client_exec_args(fd, full, EXEC_ARGS_MAX) || !client_dump(fd, regs, SB))
+        error = "EXEC with every argument failed";
+    else if (regs[R0] != 1 + 6 - 4 - 8 + 7 || regs[SP] != SB + EXEC_ARGS_MAX - ARG_REGS - 2)
+        error = "Arguments were not pushed in order";
+
+    Program fetched;
+    program_init(&fetched);
+    client_get_all(fd, &fetched);
+    if (program_size(&fetched) != n)
+        error = "Program changed across runs";
+    for (size_t i = 0; i < program_size(&fetched) && !error; i++) {
+        if (!inst_eq(program_fetch(&fetched, i), &insts[i]))
+            error = "Program changed across runs";
+    }
+
+    // Clean
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&fetched);
+    return error;
+}
+
+void test_exec_24()
+{
+    char *error = args(true);
+    if (!error)
+        error = args(false);
+
+    // Check error
+    check_error(error, 24);
+}
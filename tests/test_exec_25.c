@@ -0,0 +1,106 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../cache.h"
+#include "tests.h"
+
+#define CACHED_SIZE 3000 // instructions the server caches
+#define CACHED_LARGE 2000 // two of them don't fit
+
+static int connect_cached()
+{
+    int fd = connect_server(PORT);
+    client_hello(fd, PROTOCOL_VERSION);
+    return fd;
+}
+
+// Filler that leaves value in R0
+static void cached_program(Program *program, size_t size, int32_t value)
+{
+    program_init(program);
+    for (size_t i = 0; i < size - 2; i++) {
+        Instruction filler = { MOVI, R1, (int32_t)i };
+        program_add(program, filler);
+    }
+    Instruction set = { MOVI, R0, value };
+    Instruction halt = { HALT };
+    program_add(program, set);
+    program_add(program, halt);
+}
+
+static bool cached_run(int fd, Program *program, bool *hit, int32_t expect)
+{
+    int32_t r0 = 0;
+    return client_upload_cached(fd, program, hit) && client_exec(fd)
+        && client_dump(fd, &r0, 1) && r0 == expect;
+}
+
+// A program uploaded on one connection is bound by its digest on the
+// next, and the least recently used images make room for new ones
+static char *cached(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        server_config.cache_size = CACHED_SIZE;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    Program small, large, larger;
+    cached_program(&small, 3, 1);
+    cached_program(&large, CACHED_LARGE, 2);
+    cached_program(&larger, CACHED_LARGE, 3);
+
+    bool hit;
+    int first = connect_cached();
+    if (!cached_run(first, &small, &hit, 1) || hit)
+        error = "First upload failed";
+    close(first);
+
+    int fd = connect_cached();
+    if (!cached_run(fd, &small, &hit, 1) || !hit)
+        error = "Cached program was not bound";
+    if (!cached_run(fd, &large, &hit, 2) || hit)
+        error = "Large program was not uploaded";
+    if (!cached_run(fd, &larger, &hit, 3) || hit)
+        error = "Larger program was not uploaded";
+    if (!cached_run(fd, &small, &hit, 1) || hit)
+        error = "Evicted program was bound";
+
+    // The larger program pushed out both others, the small one came
+    // back next to it
+    int32_t stats[CACHE_STAT_COUNT];
+    client_dump_section(fd, DUMP_CACHE, stats, CACHE_STAT_COUNT);
+    if (stats[CACHE_HITS] != 1 || stats[CACHE_MISSES] != 4 || stats[CACHE_INSERTS] != 4
+            || stats[CACHE_EVICTIONS] != 2 || stats[CACHE_ENTRIES] != 2
+            || stats[CACHE_INSTRUCTIONS] != CACHED_LARGE + 3)
+        error = "Cache counters are wrong";
+
+    // Clean
+    close(fd);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&small);
+    program_deinit(&large);
+    program_deinit(&larger);
+    return error;
+}
+
+void test_exec_25()
+{
+    char *error = cached(true);
+    if (!error)
+        error = cached(false);
+
+    // Check error
+    check_error(error, 25);
+}
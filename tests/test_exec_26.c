@@ -0,0 +1,148 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../cache.h"
+#include "tests.h"
+
+#define SHARED_CACHE 3000 // instructions the server caches
+#define SHARED_SMALL 10
+#define SHARED_LARGE 2995 // pushes out the small one
+
+static int connect_shared()
+{
+    int fd = connect_server(PORT);
+    client_hello(fd, PROTOCOL_VERSION);
+    return fd;
+}
+
+// Filler that leaves value in R0
+static void shared_program(Program *program, size_t size, int32_t value)
+{
+    program_init(program);
+    for (size_t i = 0; i < size - 2; i++) {
+        Instruction filler = { MOVI, R1, (int32_t)i };
+        program_add(program, filler);
+    }
+    Instruction set = { MOVI, R0, value };
+    Instruction halt = { HALT };
+    program_add(program, set);
+    program_add(program, halt);
+}
+
+static bool shared_exec(int fd, int32_t expect)
+{
+    int32_t r0 = 0;
+    return client_exec(fd) && client_dump(fd, &r0, 1) && r0 == expect;
+}
+
+static int32_t shared_bound(int fd)
+{
+    int32_t stats[CACHE_STAT_COUNT] = {0};
+    client_dump_section(fd, DUMP_CACHE, stats, CACHE_STAT_COUNT);
+    return stats[CACHE_BOUND];
+}
+
+static size_t shared_size(int fd)
+{
+    Program fetched;
+    program_init(&fetched);
+    client_get_all(fd, &fetched);
+    size_t size = program_size(&fetched);
+    program_deinit(&fetched);
+    return size;
+}
+
+// Two connections run one cached image, the one that changes it gets
+// a copy of its own and the other keeps running the image even once
+// it is evicted
+static char *shared(bool uring, bool jit)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        server_config.jit = jit;
+        server_config.cache_size = SHARED_CACHE;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+    Program small, large;
+    shared_program(&small, SHARED_SMALL, 7);
+    shared_program(&large, SHARED_LARGE, 8);
+
+    bool hit;
+    int a = connect_shared();
+    int b = connect_shared();
+    if (!client_upload_cached(a, &small, &hit) || hit)
+        error = "First upload failed";
+    if (!client_upload_cached(b, &small, &hit) || !hit)
+        error = "Cached program was not bound";
+    if (shared_bound(a) != 2)
+        error = "Image is not shared";
+    if (!shared_exec(a, 7) || !shared_exec(b, 7))
+        error = "Shared image did not run";
+
+    // Copied on write
+    if (!client_delete(a, 0, 1) || shared_size(a) != SHARED_SMALL - 1)
+        error = "Delete failed";
+    if (shared_size(b) != SHARED_SMALL)
+        error = "Delete changed the shared image";
+    if (shared_bound(b) != 1)
+        error = "Changed program is still bound";
+    if (!shared_exec(a, 7) || !shared_exec(b, 7))
+        error = "Copied program did not run";
+
+    // Evicted while b runs it
+    if (!client_upload_cached(a, &large, &hit) || hit || !shared_exec(a, 8))
+        error = "Large program was not uploaded";
+    if (shared_bound(a) != 1)
+        error = "Evicted image is still counted";
+    if (!shared_exec(b, 7) || shared_size(b) != SHARED_SMALL)
+        error = "Evicted image did not run";
+
+    // Closed connections let go of the image
+    int c = connect_shared();
+    int d = connect_shared();
+    int control = connect_shared();
+    if (!client_upload_cached(c, &small, &hit) || !client_upload_cached(d, &small, &hit)
+            || shared_bound(control) != 2)
+        error = "Image was not bound again";
+    close(c);
+    close(d);
+    int32_t bound = -1;
+    for (int i = 0; i < 1000 && (bound = shared_bound(control)) != 0; i++) {
+        usleep(1000);
+    }
+    if (bound != 0)
+        error = "Closed connections are still bound";
+
+    // Clean
+    close(a);
+    close(b);
+    close(control);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    program_deinit(&small);
+    program_deinit(&large);
+    return error;
+}
+
+void test_exec_26()
+{
+    char *error = shared(true, false);
+    if (!error)
+        error = shared(false, false);
+    if (!error)
+        error = shared(true, true);
+
+    // Check error
+    check_error(error, 26);
+}
@@ -0,0 +1,141 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../sched.h"
+#include "../utils.h"
+#include "tests.h"
+
+#define QUEUE_CONNS 8
+#define QUEUE_EXECS 20 // pipelined by every connection
+#define QUEUE_LOOPS 1000
+#define QUEUE_IDLE_US 300000
+#define QUEUE_IDLE_TICKS 5 // CPU time the idle server may use
+
+// User and system time of all the threads of pid, in clock ticks
+static long queue_ticks(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    unsigned long utime = 0, stime = 0;
+    int rv = fscanf(f, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime);
+    fclose(f);
+    return rv == 2 ? (long)(utime + stime) : -1;
+}
+
+// Counts R0 up to QUEUE_LOOPS
+static void queue_program(Program *program)
+{
+    program_init(program);
+    Instruction i0 = { MOVI,    R1, QUEUE_LOOPS };
+    Instruction i1 = { ADDI,    R0, R0, 1 };
+    Instruction i2 = { SUBI,    R1, R1, 1 };
+    Instruction i3 = { BNEI,    1, R1, 0 };
+    Instruction i4 = { HALT };
+    program_add(program, i0);
+    program_add(program, i1);
+    program_add(program, i2);
+    program_add(program, i3);
+    program_add(program, i4);
+}
+
+// VMs of many connections executing at once all get to run from the
+// run queue, and once it is empty the server sleeps until there is I/O
+static char *queue(bool uring)
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = uring;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+
+    int fds[QUEUE_CONNS];
+    for (int i = 0; i < QUEUE_CONNS; i++) {
+        Program program;
+        queue_program(&program);
+        fds[i] = connect_server(PORT);
+        if (!client_merge_all(fds[i], &program))
+            error = "Upload failed";
+        program_deinit(&program);
+    }
+
+    // Every connection queues all its runs before any reply is read
+    struct {
+        RequestHeader header;
+        RequestHeader dump;
+        uint32_t args[2];
+    } __attribute__((packed)) reqs[QUEUE_EXECS];
+    for (int i = 0; i < QUEUE_EXECS; i++) {
+        reqs[i].header = (RequestHeader) { EXEC, 0 };
+        reqs[i].dump = (RequestHeader) { DUMP, sizeof(reqs[i].args) };
+        reqs[i].args[0] = R0;
+        reqs[i].args[1] = 1;
+    }
+    for (int i = 0; i < QUEUE_CONNS; i++) {
+        write_all(fds[i], reqs, sizeof(reqs));
+    }
+
+    Response res;
+    for (int i = 0; i < QUEUE_CONNS; i++) {
+        for (int j = 0; j < QUEUE_EXECS; j++) {
+            read_all(fds[i], &res, sizeof(res.header));
+            read_all(fds[i], res.payload, res.header.size);
+            if (res.header.status != SUCCESS)
+                error = "Queued EXEC failed";
+
+            read_all(fds[i], &res, sizeof(res.header));
+            read_all(fds[i], res.payload, res.header.size);
+            if (res.header.status != SUCCESS || ((int32_t *)res.payload)[0] != QUEUE_LOOPS)
+                error = "Queued VM returned a wrong value";
+        }
+    }
+
+    int32_t before[SCHED_STAT_COUNT];
+    if (!client_dump_section(fds[0], DUMP_SCHED, before, SCHED_STAT_COUNT)
+            || (uint32_t)before[SCHED_SLICES] < QUEUE_CONNS * QUEUE_EXECS)
+        error = "Queued VMs did not run in slices";
+
+    // Nothing is runnable, the server must not spin
+    long ticks = queue_ticks(pid);
+    usleep(QUEUE_IDLE_US);
+    if (queue_ticks(pid) - ticks > QUEUE_IDLE_TICKS)
+        error = "Idle server kept running";
+
+    int32_t after[SCHED_STAT_COUNT];
+    client_dump_section(fds[0], DUMP_SCHED, after, SCHED_STAT_COUNT);
+    if (after[SCHED_SLICES] != before[SCHED_SLICES])
+        error = "Slices ran with an empty run queue";
+
+    // Clean
+    for (int i = 0; i < QUEUE_CONNS; i++) {
+        close(fds[i]);
+    }
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    return error;
+}
+
+void test_exec_27()
+{
+    char *error = queue(true);
+    if (!error)
+        error = queue(false);
+
+    // Check error
+    check_error(error, 27);
+}
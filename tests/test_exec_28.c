@@ -0,0 +1,177 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../el.h"
+#include "../slab.h"
+#include "../utils.h"
+#include "tests.h"
+
+#define EPOLL_CONNS 300
+#define EPOLL_LOOPS 100 // plus the index of the connection
+#define EPOLL_LONG 20000 // iterations run by the peer that hangs up
+#define EPOLL_IDLE_US 300000
+#define EPOLL_IDLE_TICKS 5 // CPU time the idle server may use
+
+// User and system time of all the threads of pid, in clock ticks
+static long epoll_ticks(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    unsigned long utime = 0, stime = 0;
+    int rv = fscanf(f, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+            &utime, &stime);
+    fclose(f);
+    return rv == 2 ? (long)(utime + stime) : -1;
+}
+
+// Wait for the server to hold count connections
+static bool epoll_live(int fd, int32_t count)
+{
+    for (int tries = 0; tries < 1000; tries++) {
+        int32_t stats[EL_SLAB_COUNT][SLAB_STAT_COUNT];
+        client_dump_section(fd, DUMP_SLAB, &stats[0][0], EL_SLAB_COUNT * SLAB_STAT_COUNT);
+        if (stats[EL_SLAB_CONN][SLAB_LIVE] == count)
+            return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+// Counts R0 up to loops
+static bool epoll_upload(int fd, int32_t loops)
+{
+    Program program;
+    program_init(&program);
+    Instruction i0 = { MOVI,    R1, loops };
+    Instruction i1 = { ADDI,    R0, R0, 1 };
+    Instruction i2 = { SUBI,    R1, R1, 1 };
+    Instruction i3 = { BNEI,    1, R1, 0 };
+    Instruction i4 = { HALT };
+    program_add(&program, i0);
+    program_add(&program, i1);
+    program_add(&program, i2);
+    program_add(&program, i3);
+    program_add(&program, i4);
+    bool rv = client_merge_all(fd, &program);
+    program_deinit(&program);
+    return rv;
+}
+
+// Every connection sends EXEC and DUMP before any reply is read, so
+// each one goes through all the states it is registered for
+static bool epoll_round(int *fds, int count)
+{
+    struct {
+        RequestHeader header;
+        RequestHeader dump;
+        uint32_t args[2];
+    } __attribute__((packed)) req = {
+        { EXEC, 0 },
+        { DUMP, sizeof(req.args) },
+        { R0, 1 },
+    };
+    for (int i = 0; i < count; i++) {
+        write_all(fds[i], &req, sizeof(req));
+    }
+
+    bool rv = true;
+    Response res;
+    for (int i = 0; i < count; i++) {
+        read_all(fds[i], &res, sizeof(res.header));
+        read_all(fds[i], res.payload, res.header.size);
+        rv &= res.header.status == SUCCESS;
+
+        read_all(fds[i], &res, sizeof(res.header));
+        read_all(fds[i], res.payload, res.header.size);
+        rv &= res.header.status == SUCCESS && ((int32_t *)res.payload)[0] == EPOLL_LOOPS + i;
+    }
+    return rv;
+}
+
+// Many connections served by epoll, closed and replaced on the same fds
+// and hung up on while their VM runs, the others are not disturbed and
+// the server sleeps once they are all idle
+static char *epoll()
+{
+    int pid = fork();
+    if (!pid) {
+        freopen("/dev/null", "w", stdout);
+        server_config.uring = false;
+        start_server(PORT);
+    }
+
+    usleep(1000);
+    char *error = NULL;
+
+    int control = connect_server(PORT);
+    int fds[EPOLL_CONNS];
+    for (int i = 0; i < EPOLL_CONNS; i++) {
+        fds[i] = connect_server(PORT);
+        if (!epoll_upload(fds[i], EPOLL_LOOPS + i))
+            error = "Upload failed";
+    }
+    if (!epoll_round(fds, EPOLL_CONNS))
+        error = "Round trip failed";
+
+    // The server reuses the fds of the closed connections
+    for (int i = 0; i < EPOLL_CONNS; i += 2) {
+        close(fds[i]);
+    }
+    if (!epoll_live(control, 1 + EPOLL_CONNS / 2))
+        error = "Closed connections were not removed";
+    for (int i = 0; i < EPOLL_CONNS; i += 2) {
+        fds[i] = connect_server(PORT);
+        int32_t r0 = -1;
+        if (!client_dump(fds[i], &r0, 1) || r0 != 0)
+            error = "New connection got the state of a closed one";
+        if (!epoll_upload(fds[i], EPOLL_LOOPS + i))
+            error = "Upload on a reused fd failed";
+    }
+    if (!epoll_round(fds, EPOLL_CONNS))
+        error = "Round trip on reused fds failed";
+
+    // The peer is gone before its VM stops
+    int gone = connect_server(PORT);
+    epoll_upload(gone, EPOLL_LONG);
+    RequestHeader exec = { EXEC, 0 };
+    write_all(gone, &exec, sizeof(exec));
+    close(gone);
+    if (!epoll_live(control, 1 + EPOLL_CONNS))
+        error = "Connection hung up on while running was not removed";
+    if (!epoll_round(fds, EPOLL_CONNS))
+        error = "Round trip after a hang up failed";
+
+    // Nothing to do, the server must not spin
+    long ticks = epoll_ticks(pid);
+    usleep(EPOLL_IDLE_US);
+    if (epoll_ticks(pid) - ticks > EPOLL_IDLE_TICKS)
+        error = "Idle server kept running";
+
+    // Clean
+    for (int i = 0; i < EPOLL_CONNS; i++) {
+        close(fds[i]);
+    }
+    close(control);
+    kill(pid, SIGQUIT);
+    waitpid(pid, NULL, 0);
+    return error;
+}
+
+void test_exec_28()
+{
+    char *error = epoll();
+
+    // Check error
+    check_error(error, 28);
+}
@@ -28,12 +28,7 @@ void test_exec_3()
     int pid = fork();
     if (pid) {
         usleep(1000);
-        int fd = socket(AF_INET, SOCK_STREAM, 0);
-        struct sockaddr_in addr = {0};
-        addr.sin_family = AF_INET;
-        addr.sin_port = ntohs(PORT);
-        addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
-        connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        int fd = connect_server(PORT);
 
         Program program_1;
         Program program_2;
@@ -92,6 +87,7 @@ void test_exec_3()
 
         // Clean
         kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
         close(fd);
         program_deinit(&program_1);
         program_deinit(&program_2);
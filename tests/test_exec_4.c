@@ -11,12 +11,7 @@
 
 static char *exec_program_1()
 {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(PORT);
-    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
-    connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    int fd = connect_server(PORT);
 
     Program program_1;
     program_init(&program_1);
@@ -42,12 +37,7 @@ static char *exec_program_2()
     const int32_t n = 5;
     int32_t expected = factorial(n);
 
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(PORT);
-    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
-    connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    int fd = connect_server(PORT);
 
     Program program_2;
     program_init(&program_2);
@@ -98,6 +88,7 @@ void test_exec_4()
 
         // Clean
         kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
 
         // Check error
         check_error(error, 4);
@@ -0,0 +1,78 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../utils.h"
+#include "tests.h"
+
+void test_exec_5()
+{
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        char *error = NULL;
+
+        // Static operand out of memory is rejected on upload
+        Instruction i0 = { MOVI,    MEMORY_SIZE, 1 };
+        program_add(&program, i0);
+        if (client_merge_all(fd, &program))
+            error = "Out of bounds operand was accepted";
+
+        // Branch target is checked once the program is complete
+        Instruction i1 = { MOVI,    R0, 1 };
+        Instruction i2 = { B,       3 };
+        Instruction i3 = { HALT };
+        program_add(&program, i1);
+        program_add(&program, i2);
+        program_add(&program, i3);
+        if (!client_merge_all(fd, &program))
+            error = "Valid program was rejected";
+        if (client_exec(fd))
+            error = "Out of bounds branch was accepted";
+
+        // Fixing the branch makes the program runnable
+        client_delete(fd, 1, 1);
+        if (!client_exec(fd))
+            error = "Valid program was not executed";
+
+        int32_t memory;
+        client_dump(fd, &memory, 1);
+        if (memory != 1)
+            error = "Verified program returned a wrong value";
+
+        // INSERT too short to hold its start and size
+        struct {
+            RequestHeader header;
+            uint64_t start;
+        } __attribute__((packed)) insert = { { INSERT, sizeof(uint64_t) }, 0 };
+        Response res;
+        write_all(fd, &insert, sizeof(insert));
+        read_all(fd, &res, sizeof(res.header));
+        read_all(fd, res.payload, res.header.size);
+        if (res.header.status != FAILURE)
+            error = "Truncated insert was accepted";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 5);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        start_server(PORT);
+    }
+}
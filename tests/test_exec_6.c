@@ -0,0 +1,110 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../code.h"
+#include "tests.h"
+
+void test_exec_6()
+{
+    const int32_t n = 12;
+    int32_t expected = factorial(n);
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        char *error = NULL;
+
+        // Nothing fused before a program is built
+        int32_t fused[FUSED_COUNT];
+        client_dump_section(fd, DUMP_FUSION, fused, FUSED_COUNT);
+        for (size_t i = 0; i < FUSED_COUNT; i++) {
+            if (fused[i])
+                error = "Fusion counters start dirty";
+        }
+
+        Program program;
+        program_init(&program);
+
+        Instruction i0 = { MOVI,    R1, n };
+        Instruction i1 = { MOV,     R0, R1 };
+        Instruction i2 = { SUBI,    R1, R1, 1 };
+        Instruction i3 = { BEQI,    6, R1, 1 };
+        Instruction i4 = { MUL,     R0, R0, R1 };
+        Instruction i5 = { B,       2 };
+        Instruction i6 = { HALT };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+        program_add(&program, i3);
+        program_add(&program, i4);
+        program_add(&program, i5);
+        program_add(&program, i6);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        int32_t memory;
+        client_dump(fd, &memory, 1);
+        if (memory != expected)
+            error = "Fused factorial calculation does not match";
+
+        client_dump_section(fd, DUMP_FUSION, fused, FUSED_COUNT);
+        if (fused[MOV_SUBI - OPCODE_COUNT] != 1
+            || fused[SUBI_BEQI - OPCODE_COUNT] != 1
+            || fused[MUL_B - OPCODE_COUNT] != 1)
+            error = "Expected fusions did not fire";
+
+        // A fused op is charged like the instructions that ran, the B
+        // after a taken BEQI is not
+        int run = connect_server(PORT);
+        client_hello(run, PROTOCOL_VERSION);
+
+        Program skip;
+        program_init(&skip);
+        Instruction s0 = { BEQI,    2, R0, 0 };
+        Instruction s1 = { B,       3 };
+        Instruction s2 = { HALT };
+        Instruction s3 = { HALT };
+        program_add(&skip, s0);
+        program_add(&skip, s1);
+        program_add(&skip, s2);
+        program_add(&skip, s3);
+
+        RunPoke taken = { R0, 0 };
+        RunPoke not_taken = { R0, 1 };
+        RunResult result;
+        if (!client_run(run, &skip, &taken, 1, NULL, 0, &result, NULL)
+                || result.result != LR_SUCCESS || result.instructions != 2)
+            error = "Taken BEQI was charged for the B";
+        if (!client_run(run, NULL, &not_taken, 1, NULL, 0, &result, NULL)
+                || result.result != LR_SUCCESS || result.instructions != 3)
+            error = "BEQI and B were not charged";
+
+        client_dump_section(run, DUMP_FUSION, fused, FUSED_COUNT);
+        if (fused[BEQI_B - OPCODE_COUNT] != 1)
+            error = "BEQI and B were not fused";
+        close(run);
+        program_deinit(&skip);
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 6);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
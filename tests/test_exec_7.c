@@ -0,0 +1,168 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "../vm.h"
+#include "tests.h"
+
+// Run program on a VM of its own, done tells how it ended
+static bool jit_done(Program *program, ExecDone *done)
+{
+    int fd = connect_server(PORT);
+    bool rv = client_hello(fd, PROTOCOL_VERSION) == 2 && client_notify(fd, true)
+        && client_upload(fd, program) && client_exec(fd) && client_done(fd, done);
+    close(fd);
+    return rv;
+}
+
+// Straight-line program of size instructions
+static void jit_straight(Program *program, size_t size)
+{
+    program_init(program);
+    for (size_t i = 0; i < size - 1; i++) {
+        Instruction inst = { MOVI, R1, (int32_t)i };
+        program_add(program, inst);
+    }
+    Instruction halt = { HALT };
+    program_add(program, halt);
+}
+
+void test_exec_7()
+{
+    const int32_t n = 10;
+    int32_t expected = factorial(n);
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        // Push n..1 on the stack then multiply them back, the loops
+        // are preempted many times and the stack goes through the
+        // guarded native push and pop
+        Instruction i0  = { MOVI,    R1, n };
+        Instruction i1  = { PUSH,    R1 };
+        Instruction i2  = { SUBI,    R1, R1, 1 };
+        Instruction i3  = { BNEI,    1, R1, 0 };
+        Instruction i4  = { MOVI,    R0, 1 };
+        Instruction i5  = { MOVI,    R2, n };
+        Instruction i6  = { POP,     R1 };
+        Instruction i7  = { MUL,     R0, R0, R1 };
+        Instruction i8  = { SUBI,    R2, R2, 1 };
+        Instruction i9  = { BNEI,    6, R2, 0 };
+        Instruction i10 = { MOVI,    R3, 3 };
+        Instruction i11 = { DIV,     R1, R0, R3 };
+        Instruction i12 = { HALT };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+        program_add(&program, i3);
+        program_add(&program, i4);
+        program_add(&program, i5);
+        program_add(&program, i6);
+        program_add(&program, i7);
+        program_add(&program, i8);
+        program_add(&program, i9);
+        program_add(&program, i10);
+        program_add(&program, i11);
+        program_add(&program, i12);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        char *error = NULL;
+
+        int32_t memory[2];
+        client_dump(fd, memory, 2);
+        if (memory[R0] != expected)
+            error = "JIT factorial calculation does not match";
+        else if (memory[R1] != expected / 3)
+            error = "JIT division does not match";
+
+        // Not a single instruction ran in the interpreter
+        int32_t stats[JIT_STAT_COUNT];
+        if (!client_dump_section(fd, DUMP_JIT, stats, JIT_STAT_COUNT)
+                || stats[JIT_BAILS] != 0 || stats[JIT_NATIVE] != 1 + 3 * n + 2 + 4 * n + 3)
+            error = "Program did not run as native code";
+
+        // The LOAD of a register bails out on every iteration, the
+        // interpreter must not be charged again for what native code
+        // was charged for already
+        Program bail;
+        program_init(&bail);
+        Instruction b0 = { MOVI,    R1, 100 };
+        Instruction b1 = { MOVI,    R3, 0 };
+        Instruction b2 = { LOAD,    R2, R3, 0 };
+        Instruction b3 = { ADDI,    R0, R0, 1 };
+        Instruction b4 = { SUBI,    R1, R1, 1 };
+        Instruction b5 = { BNEI,    2, R1, 0 };
+        Instruction b6 = { HALT };
+        program_add(&bail, b0);
+        program_add(&bail, b1);
+        program_add(&bail, b2);
+        program_add(&bail, b3);
+        program_add(&bail, b4);
+        program_add(&bail, b5);
+        program_add(&bail, b6);
+        ExecDone done;
+        if (!jit_done(&bail, &done) || done.result != LR_SUCCESS || done.r0 != 100
+                || done.instructions != 3 + 100 * 4)
+            error = "Bailing out charged instructions twice";
+
+        // Times out on the same instruction as the interpreter, the one
+        // that ends the program isn't held against the limit
+        Program last, past;
+        jit_straight(&last, TIMER_LIMIT + 1);
+        jit_straight(&past, TIMER_LIMIT + 2);
+        if (!jit_done(&last, &done) || done.result != LR_SUCCESS)
+            error = "Program ending on the time limit timed out";
+        if (!jit_done(&past, &done) || done.result != LR_TIME_EXCEEDED)
+            error = "Program past the time limit did not time out";
+
+        // INT_MIN / -1 fails the program instead of the server
+        Program overflow;
+        program_init(&overflow);
+        Instruction o0 = { MOVI,    R1, INT32_MIN };
+        Instruction o1 = { MOVI,    R2, -1 };
+        Instruction o2 = { DIV,     R0, R1, R2 };
+        Instruction o3 = { HALT };
+        program_add(&overflow, o0);
+        program_add(&overflow, o1);
+        program_add(&overflow, o2);
+        program_add(&overflow, o3);
+        if (!jit_done(&overflow, &done) || done.result != LR_MALFORMED_INSTRUCTION
+                || done.fault != DIVISION_OVERFLOW)
+            error = "DIV overflow did not fail the program";
+        Instruction o4 = { DIVI,    R0, R1, -1 };
+        *program_fetch(&overflow, 2) = o4;
+        if (!jit_done(&overflow, &done) || done.result != LR_MALFORMED_INSTRUCTION
+                || done.fault != DIVISION_OVERFLOW)
+            error = "DIVI overflow did not fail the program";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+        program_deinit(&bail);
+        program_deinit(&last);
+        program_deinit(&past);
+        program_deinit(&overflow);
+
+        // Check error
+        check_error(error, 7);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        server_config.jit = true;
+        start_server(PORT);
+    }
+}
@@ -0,0 +1,99 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+void test_exec_8()
+{
+    const int32_t n = 10;
+    const int32_t expected = n * (n + 1) / 2;
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        Program program;
+        program_init(&program);
+
+        // Build a list of n..1 on the heap, sum it while freeing the
+        // nodes and allocate one more node that reuses a freed block
+        Instruction i0  = { MOVI,    R2, n };
+        Instruction i1  = { MOVI,    R3, 2 };
+        Instruction i2  = { HALLO,   R0, R3 };
+        Instruction i3  = { STORE,   R0, R2, 0 };
+        Instruction i4  = { STORE,   R0, R1, 1 };
+        Instruction i5  = { MOV,     R1, R0 };
+        Instruction i6  = { SUBI,    R2, R2, 1 };
+        Instruction i7  = { BNEI,    2, R2, 0 };
+        Instruction i8  = { MOVI,    R0, 0 };
+        Instruction i9  = { LOAD,    R3, R1, 0 };
+        Instruction i10 = { ADD,     R0, R0, R3 };
+        Instruction i11 = { LOAD,    R3, R1, 1 };
+        Instruction i12 = { HFREE,   R1 };
+        Instruction i13 = { MOV,     R1, R3 };
+        Instruction i14 = { BNEI,    9, R1, 0 };
+        Instruction i15 = { MOVI,    R3, 2 };
+        Instruction i16 = { HALLO,   R2, R3 };
+        Instruction i17 = { HALT };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+        program_add(&program, i3);
+        program_add(&program, i4);
+        program_add(&program, i5);
+        program_add(&program, i6);
+        program_add(&program, i7);
+        program_add(&program, i8);
+        program_add(&program, i9);
+        program_add(&program, i10);
+        program_add(&program, i11);
+        program_add(&program, i12);
+        program_add(&program, i13);
+        program_add(&program, i14);
+        program_add(&program, i15);
+        program_add(&program, i16);
+        program_add(&program, i17);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        char *error = NULL;
+
+        int32_t memory;
+        client_dump(fd, &memory, 1);
+        if (memory != expected)
+            error = "Heap list sum does not match";
+
+        int32_t stats[HEAP_STAT_COUNT];
+        client_dump_section(fd, DUMP_HEAP, stats, HEAP_STAT_COUNT);
+        if (stats[HEAP_ALLOCS] != n + 1
+            || stats[HEAP_FREES] != n
+            || stats[HEAP_FAILURES] != 0
+            || stats[HEAP_REUSED] != 1
+            || stats[HEAP_LIVE_BLOCKS] != 1
+            || stats[HEAP_LIVE_WORDS] != 2
+            || stats[HEAP_PEAK_WORDS] != 2 * n
+            || stats[HEAP_TOP_WORDS] != 3 * n)
+            error = "Heap counters do not match";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 8);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
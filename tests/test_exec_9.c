@@ -0,0 +1,76 @@
+#include <arpa/inet.h>
+#include <assert.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../program.h"
+#include "../server.h"
+#include "../client.h"
+#include "tests.h"
+
+void test_exec_9()
+{
+    const uint32_t memory_size = 1 << 20;
+    const int32_t far = 1000000;
+
+    int pid = fork();
+    if (pid) {
+        usleep(1000);
+        int fd = connect_server(PORT);
+
+        char *error = NULL;
+
+        // Sizes are rounded up to a power of two
+        uint32_t size = 3000;
+        if (!client_setup(fd, &size) || size != 4096)
+            error = "Memory size was not rounded up";
+
+        size = memory_size;
+        if (!client_setup(fd, &size) || size != memory_size)
+            error = "Memory size was not granted";
+
+        Program program;
+        program_init(&program);
+
+        Instruction i0 = { MOVI,    far, 42 };
+        Instruction i1 = { LOAD,    R0, R1, far };
+        Instruction i2 = { MOVI,    R3, 100000 };
+        Instruction i3 = { HALLO,   R1, R3 };
+        Instruction i4 = { HALT };
+
+        program_add(&program, i0);
+        program_add(&program, i1);
+        program_add(&program, i2);
+        program_add(&program, i3);
+        program_add(&program, i4);
+
+        client_merge_all(fd, &program);
+        client_exec(fd);
+
+        int32_t memory[2];
+        client_dump(fd, memory, 2);
+        if (memory[R0] != 42)
+            error = "Far load does not match";
+        else if (memory[R1] != HEAP_BASE(memory_size) + 1)
+            error = "Large heap block was not allocated";
+
+        // Registers, the far word and the block header
+        int32_t pages[DUMP_PAGES_SIZE];
+        client_dump_section(fd, DUMP_PAGES, pages, DUMP_PAGES_SIZE);
+        if (pages[0] != memory_size || pages[1] > 3)
+            error = "Memory was not paged in lazily";
+
+        // Clean
+        close(fd);
+        kill(pid, SIGQUIT);
+        waitpid(pid, NULL, 0);
+        program_deinit(&program);
+
+        // Check error
+        check_error(error, 9);
+    } else {
+        freopen("/dev/null", "w", stdout);
+        start_server(PORT);
+    }
+}
@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <assert.h>
@@ -30,10 +31,84 @@ void check_error(char *error, int testno)
     }
 }
 
+// Connect to the test server on port, which may still be starting, -1
+// if it can't be reached
+int connect_server(int port)
+{
+    return connect_server_rcvbuf(port, 0);
+}
+
+// Same with a receive buffer of rcvbuf bytes unless it is 0, it has to
+// be set before connecting to hold the window down
+int connect_server_rcvbuf(int port, int rcvbuf)
+{
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(port);
+    addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);
+
+    // A socket is not reused once its connect failed
+    for (int i = 0; i < 100; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (rcvbuf)
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+        close(fd);
+        usleep(1000);
+    }
+    return -1;
+}
+
+// Resident memory of pid in kB
+long rss_of(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return -1;
+
+    char line[256];
+    long rss = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+            break;
+    }
+    fclose(file);
+    return rss;
+}
+
 int main()
 {
     test_exec_1();
     test_exec_2();
     test_exec_3();
     test_exec_4();
+    test_exec_5();
+    test_exec_6();
+    test_exec_7();
+    test_exec_8();
+    test_exec_9();
+    test_exec_10();
+    test_exec_11();
+    test_exec_12();
+    test_exec_13();
+    test_exec_14();
+    test_exec_15();
+    test_exec_16();
+    test_exec_17();
+    test_exec_18();
+    test_exec_19();
+    test_exec_20();
+    test_exec_21();
+    test_exec_22();
+    test_exec_23();
+    test_exec_24();
+    test_exec_25();
+    test_exec_26();
+    test_exec_27();
+    test_exec_28();
 }
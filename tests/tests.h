@@ -5,10 +5,37 @@
 
 int32_t factorial(int32_t n);
 void check_error(char *error, int testno);
+int connect_server(int port);
+int connect_server_rcvbuf(int port, int rcvbuf);
+long rss_of(int pid);
 
 void test_exec_1();
 void test_exec_2();
 void test_exec_3();
 void test_exec_4();
+void test_exec_5();
+void test_exec_6();
+void test_exec_7();
+void test_exec_8();
+void test_exec_9();
+void test_exec_10();
+void test_exec_11();
+void test_exec_12();
+void test_exec_13();
+void test_exec_14();
+void test_exec_15();
+void test_exec_16();
+void test_exec_17();
+void test_exec_18();
+void test_exec_19();
+void test_exec_20();
+void test_exec_21();
+void test_exec_22();
+void test_exec_23();
+void test_exec_24();
+void test_exec_25();
+void test_exec_26();
+void test_exec_27();
+void test_exec_28();
 
 #endif
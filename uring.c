@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "utils.h"
+
+static int sys_setup(uint32_t entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, uint32_t submit, uint32_t complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, uint32_t op, void *arg, uint32_t n)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static void *map_ring(int fd, size_t size, uint64_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, (off_t)offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Hand buffer bid back to the kernel, visible once the tail is published
+static void buf_add(Uring *ring, uint16_t bid)
+{
+    struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (URING_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    ring->br_tail++;
+}
+
+static void buf_publish(Uring *ring)
+{
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+// Set up the rings and the receive buffers. Fails on kernels without
+// io_uring or without provided buffer rings, multishot accept came in
+// the same release (5.19) as the latter
+bool uring_init(Uring *ring)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params p = {0};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    ring->fd = sys_setup(URING_ENTRIES, &p);
+    if (ring->fd < 0) {
+        printf("io_uring is not available: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        printf("io_uring lacks the features needed\n");
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > ring->sq_ring_size)
+        ring->sq_ring_size = cq_size;
+    ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->sq_ring;
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+
+    ring->br_size = URING_BUFS * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->bufs = malloc((size_t)URING_BUFS * BUF_SIZE);
+
+    if (!ring->sq_ring || !ring->sqes || ring->br == MAP_FAILED || !ring->bufs) {
+        printf("Failed to map io_uring\n");
+        if (ring->br == MAP_FAILED)
+            ring->br = NULL;
+        uring_deinit(ring);
+        return false;
+    }
+
+    ring->sq_head = (uint32_t *)(ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (uint32_t *)(ring->sq_ring + p.sq_off.tail);
+    ring->sq_array = (uint32_t *)(ring->sq_ring + p.sq_off.array);
+    ring->sq_mask = *(uint32_t *)(ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+
+    ring->cq_head = (uint32_t *)(ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (uint32_t *)(ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = *(uint32_t *)(ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(ring->cq_ring + p.cq_off.cqes);
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_GROUP;
+    if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        printf("io_uring lacks provided buffer rings: %s\n", strerror(errno));
+        uring_deinit(ring);
+        return false;
+    }
+
+    for (uint16_t bid = 0; bid < URING_BUFS; bid++) {
+        buf_add(ring, bid);
+    }
+    buf_publish(ring);
+
+    return true;
+}
+
+void uring_deinit(Uring *ring)
+{
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->br)
+        munmap(ring->br, ring->br_size);
+    free(ring->bufs);
+    close(ring->fd);
+}
+
+// Next free sqe, the queue is flushed to the kernel first when full
+static struct io_uring_sqe *get_sqe(Uring *ring)
+{
+    uint32_t tail = *ring->sq_tail;
+    uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring->sq_entries) {
+        if (uring_enter(ring, false) < 0)
+            return NULL;
+    }
+
+    uint32_t index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+static void put_sqe(Uring *ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+}
+
+// Accept connections on fd until the kernel stops the request, which
+// it tells by clearing IORING_CQE_F_MORE
+bool uring_accept(Uring *ring, int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = URING_DATA(fd, URING_ACCEPT);
+    put_sqe(ring);
+    return true;
+}
+
+// Receive into a provided buffer, no more than rbuf has room for. The
+// connection needs no buffer of its own until the data is there. The
+// payload of a large frame is received where it goes instead
+bool uring_recv(Uring *ring, Conn *conn)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    if (conn->stream_left) {
+        sqe->addr = (uint64_t)(uintptr_t)conn->stream;
+        sqe->len = (uint32_t)conn->stream_left;
+    } else {
+        sqe->len = (uint32_t)(BUF_SIZE - conn->rbuf_size);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_GROUP;
+    }
+    sqe->user_data = URING_DATA(conn->fd, URING_RECV);
+    put_sqe(ring);
+
+    conn->inflight = true;
+    return true;
+}
+
+// Send what is left of the first chunk of wbuf, the completion sends
+// the next one
+bool uring_send(Uring *ring, Conn *conn)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    struct iovec iov;
+    conn_wbuf_iov(conn, &iov, 1);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov.iov_base;
+    sqe->len = (uint32_t)iov.iov_len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_DATA(conn->fd, URING_SEND);
+    put_sqe(ring);
+
+    conn->inflight = true;
+    return true;
+}
+
+// Report every time fd becomes readable until the kernel clears
+// IORING_CQE_F_MORE, used for the eventfd of the event loop
+bool uring_poll(Uring *ring, int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_DATA(fd, URING_WAKE);
+    put_sqe(ring);
+    return true;
+}
+
+// Report once that fd is readable, used to wait for a connection
+// without taking an fd for it
+bool uring_ready(Uring *ring, int fd)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_DATA(fd, URING_READY);
+    put_sqe(ring);
+    return true;
+}
+
+// Submit everything queued so far and, with wait, block until at least
+// one completion is there. This is the only system call of a round
+int uring_enter(Uring *ring, bool wait)
+{
+    if (!wait && !ring->queued)
+        return 0;
+
+    uint32_t flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int rv;
+    do {
+        rv = sys_enter(ring->fd, ring->queued, wait ? 1 : 0, flags);
+    } while (rv < 0 && errno == EINTR);
+
+    if (rv >= 0)
+        ring->queued -= MIN((uint32_t)rv, ring->queued);
+    return rv;
+}
+
+// Oldest completion not consumed yet, NULL if there is none
+struct io_uring_cqe *uring_peek(Uring *ring)
+{
+    uint32_t head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_advance(Uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Data of a receive completion
+uint8_t *uring_buf(Uring *ring, struct io_uring_cqe *cqe)
+{
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    return ring->bufs + (size_t)bid * BUF_SIZE;
+}
+
+// Give the buffer of a receive completion back once its data is copied
+void uring_recycle(Uring *ring, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return;
+
+    buf_add(ring, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+    buf_publish(ring);
+}
@@ -0,0 +1,74 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#include "el.h"
+
+#define URING_ENTRIES 4096 // submission queue
+#define URING_CQ_ENTRIES (1 << 16)
+#define URING_BUFS 1024 // provided receive buffers, a power of two
+#define URING_GROUP 0 // buffer group of the receive buffers
+
+// What a completion is for, stored in the low bits of its user_data
+// with the fd above them
+typedef enum {
+    URING_ACCEPT,
+    URING_RECV,
+    URING_SEND,
+    URING_WAKE,
+    URING_READY,
+} UringOp;
+
+#define URING_OP_BITS 3
+#define URING_DATA(fd, op) (((uint64_t)(fd) << URING_OP_BITS) | (op))
+#define URING_FD(data) ((int)((data) >> URING_OP_BITS))
+#define URING_OP(data) ((UringOp)((data) & ((1 << URING_OP_BITS) - 1)))
+
+// io_uring instance driven with the raw system calls. Receives pick a
+// buffer from a ring of URING_BUFS buffers of BUF_SIZE bytes shared by
+// all the connections, so idle connections don't pin any memory in the
+// kernel. Requests are only queued by the functions below and are
+// submitted in one batch by uring_enter()
+typedef struct {
+    int fd;
+    uint8_t *sq_ring;
+    size_t sq_ring_size;
+    uint8_t *cq_ring;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t queued; // sqes written since the last uring_enter()
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint8_t *bufs;
+    uint16_t br_tail;
+} Uring;
+
+bool uring_init(Uring *ring);
+void uring_deinit(Uring *ring);
+bool uring_accept(Uring *ring, int fd);
+bool uring_recv(Uring *ring, Conn *conn);
+bool uring_send(Uring *ring, Conn *conn);
+bool uring_poll(Uring *ring, int fd);
+bool uring_ready(Uring *ring, int fd);
+int uring_enter(Uring *ring, bool wait);
+struct io_uring_cqe *uring_peek(Uring *ring);
+void uring_advance(Uring *ring);
+uint8_t *uring_buf(Uring *ring, struct io_uring_cqe *cqe);
+void uring_recycle(Uring *ring, struct io_uring_cqe *cqe);
+
+#endif
@@ -4,7 +4,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
-#define MIN(a, b) a < b ? a : b
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 void die(char *s);
 bool read_all(int fd, void *buf, size_t n);
@@ -0,0 +1,380 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vec.h"
+
+typedef struct {
+    const char *isa;
+    void (*add)(int32_t *dst, const int32_t *src, size_t n);
+    void (*sub)(int32_t *dst, const int32_t *src, size_t n);
+    void (*mul)(int32_t *dst, const int32_t *src, size_t n);
+    void (*fill)(int32_t *dst, int32_t value, size_t n);
+    int32_t (*sum)(const int32_t *src, size_t n);
+    int32_t (*min)(const int32_t *src, size_t n);
+    int32_t (*max)(const int32_t *src, size_t n);
+    int32_t (*dot)(const int32_t *a, const int32_t *b, size_t n);
+    size_t (*cmp)(const int32_t *a, const int32_t *b, size_t n);
+} VecKernels;
+
+// Scalar kernels, also used for the tails of the vector ones. The
+// arithmetic is unsigned so that overflow wraps instead of being UB
+
+static void scalar_add(int32_t *dst, const int32_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (int32_t)((uint32_t)dst[i] + (uint32_t)src[i]);
+}
+
+static void scalar_sub(int32_t *dst, const int32_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (int32_t)((uint32_t)dst[i] - (uint32_t)src[i]);
+}
+
+static void scalar_mul(int32_t *dst, const int32_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = (int32_t)((uint32_t)dst[i] * (uint32_t)src[i]);
+}
+
+static void scalar_fill(int32_t *dst, int32_t value, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        dst[i] = value;
+}
+
+static int32_t scalar_sum(const int32_t *src, size_t n)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += (uint32_t)src[i];
+    return (int32_t)sum;
+}
+
+static int32_t scalar_min(const int32_t *src, size_t n)
+{
+    int32_t min = INT32_MAX;
+    for (size_t i = 0; i < n; i++)
+        min = src[i] < min ? src[i] : min;
+    return min;
+}
+
+static int32_t scalar_max(const int32_t *src, size_t n)
+{
+    int32_t max = INT32_MIN;
+    for (size_t i = 0; i < n; i++)
+        max = src[i] > max ? src[i] : max;
+    return max;
+}
+
+static int32_t scalar_dot(const int32_t *a, const int32_t *b, size_t n)
+{
+    uint32_t dot = 0;
+    for (size_t i = 0; i < n; i++)
+        dot += (uint32_t)a[i] * (uint32_t)b[i];
+    return (int32_t)dot;
+}
+
+static size_t scalar_cmp(const int32_t *a, const int32_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i])
+            return i;
+    }
+    return n;
+}
+
+static const VecKernels scalar_kernels = {
+    "scalar",
+    scalar_add, scalar_sub, scalar_mul, scalar_fill,
+    scalar_sum, scalar_min, scalar_max, scalar_dot, scalar_cmp,
+};
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+// SSE2 is part of x86-64 so these need no runtime check. SSE2 has no
+// 32 bit multiply or min/max, they are built from what it has
+
+static __m128i sse2_mullo(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static __m128i sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+#define SSE2_BINARY(name, expr)                                         \
+static void sse2_##name(int32_t *dst, const int32_t *src, size_t n)     \
+{                                                                       \
+    size_t i = 0;                                                       \
+    for (; i + 4 <= n; i += 4) {                                        \
+        __m128i a = _mm_loadu_si128((const __m128i *)&dst[i]);          \
+        __m128i b = _mm_loadu_si128((const __m128i *)&src[i]);          \
+        _mm_storeu_si128((__m128i *)&dst[i], expr);                     \
+    }                                                                   \
+    scalar_##name(&dst[i], &src[i], n - i);                             \
+}
+
+SSE2_BINARY(add, _mm_add_epi32(a, b))
+SSE2_BINARY(sub, _mm_sub_epi32(a, b))
+SSE2_BINARY(mul, sse2_mullo(a, b))
+
+static void sse2_fill(int32_t *dst, int32_t value, size_t n)
+{
+    __m128i v = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)&dst[i], v);
+    scalar_fill(&dst[i], value, n - i);
+}
+
+static int32_t sse2_sum(const int32_t *src, size_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i *)&src[i]));
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return (int32_t)((uint32_t)scalar_sum(lanes, 4) + (uint32_t)scalar_sum(&src[i], n - i));
+}
+
+static int32_t sse2_min(const int32_t *src, size_t n)
+{
+    __m128i acc = _mm_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+        acc = sse2_select(_mm_cmplt_epi32(v, acc), v, acc);
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int32_t a = scalar_min(lanes, 4);
+    int32_t b = scalar_min(&src[i], n - i);
+    return a < b ? a : b;
+}
+
+static int32_t sse2_max(const int32_t *src, size_t n)
+{
+    __m128i acc = _mm_set1_epi32(INT32_MIN);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+        acc = sse2_select(_mm_cmpgt_epi32(v, acc), v, acc);
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int32_t a = scalar_max(lanes, 4);
+    int32_t b = scalar_max(&src[i], n - i);
+    return a > b ? a : b;
+}
+
+static int32_t sse2_dot(const int32_t *a, const int32_t *b, size_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+        acc = _mm_add_epi32(acc, sse2_mullo(va, vb));
+    }
+
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return (int32_t)((uint32_t)scalar_sum(lanes, 4) + (uint32_t)scalar_dot(&a[i], &b[i], n - i));
+}
+
+static size_t sse2_cmp(const int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+        int eq = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+        if (eq != 0xf)
+            return i + __builtin_ctz(~eq);
+    }
+    return i + scalar_cmp(&a[i], &b[i], n - i);
+}
+
+static const VecKernels sse2_kernels = {
+    "sse2",
+    sse2_add, sse2_sub, sse2_mul, sse2_fill,
+    sse2_sum, sse2_min, sse2_max, sse2_dot, sse2_cmp,
+};
+
+// AVX2 kernels are compiled for AVX2 whatever the build flags and only
+// called after checking the CPU
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define AVX2_BINARY(name, expr)                                         \
+AVX2 static void avx2_##name(int32_t *dst, const int32_t *src, size_t n) \
+{                                                                       \
+    size_t i = 0;                                                       \
+    for (; i + 8 <= n; i += 8) {                                        \
+        __m256i a = _mm256_loadu_si256((const __m256i *)&dst[i]);       \
+        __m256i b = _mm256_loadu_si256((const __m256i *)&src[i]);       \
+        _mm256_storeu_si256((__m256i *)&dst[i], expr);                  \
+    }                                                                   \
+    scalar_##name(&dst[i], &src[i], n - i);                             \
+}
+
+AVX2_BINARY(add, _mm256_add_epi32(a, b))
+AVX2_BINARY(sub, _mm256_sub_epi32(a, b))
+AVX2_BINARY(mul, _mm256_mullo_epi32(a, b))
+
+AVX2 static void avx2_fill(int32_t *dst, int32_t value, size_t n)
+{
+    __m256i v = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *)&dst[i], v);
+    scalar_fill(&dst[i], value, n - i);
+}
+
+#define AVX2_REDUCE(name, init, step, combine)                          \
+AVX2 static int32_t avx2_##name(const int32_t *src, size_t n)           \
+{                                                                       \
+    __m256i acc = _mm256_set1_epi32(init);                              \
+    size_t i = 0;                                                       \
+    for (; i + 8 <= n; i += 8)                                          \
+        acc = step(acc, _mm256_loadu_si256((const __m256i *)&src[i]));  \
+                                                                        \
+    int32_t lanes[8];                                                   \
+    _mm256_storeu_si256((__m256i *)lanes, acc);                         \
+    return combine(scalar_##name(lanes, 8), scalar_##name(&src[i], n - i)); \
+}
+
+#define WRAP_ADD(a, b) (int32_t)((uint32_t)(a) + (uint32_t)(b))
+#define MIN2(a, b) ((a) < (b) ? (a) : (b))
+#define MAX2(a, b) ((a) > (b) ? (a) : (b))
+
+AVX2_REDUCE(sum, 0, _mm256_add_epi32, WRAP_ADD)
+AVX2_REDUCE(min, INT32_MAX, _mm256_min_epi32, MIN2)
+AVX2_REDUCE(max, INT32_MIN, _mm256_max_epi32, MAX2)
+
+AVX2 static int32_t avx2_dot(const int32_t *a, const int32_t *b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+        __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(va, vb));
+    }
+
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return WRAP_ADD(scalar_sum(lanes, 8), scalar_dot(&a[i], &b[i], n - i));
+}
+
+AVX2 static size_t avx2_cmp(const int32_t *a, const int32_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+        __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+        int eq = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb)));
+        if (eq != 0xff)
+            return i + __builtin_ctz(~eq);
+    }
+    return i + scalar_cmp(&a[i], &b[i], n - i);
+}
+
+#undef WRAP_ADD
+#undef MIN2
+#undef MAX2
+
+static const VecKernels avx2_kernels = {
+    "avx2",
+    avx2_add, avx2_sub, avx2_mul, avx2_fill,
+    avx2_sum, avx2_min, avx2_max, avx2_dot, avx2_cmp,
+};
+
+static const VecKernels *kernels = &sse2_kernels;
+
+// NETVM_VEC=scalar or sse2 forces a narrower implementation
+__attribute__((constructor))
+static void vec_select(void)
+{
+    const char *isa = getenv("NETVM_VEC");
+    if (isa && strcmp(isa, "scalar") == 0) {
+        kernels = &scalar_kernels;
+        return;
+    }
+    if (isa && strcmp(isa, "sse2") == 0)
+        return;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels = &avx2_kernels;
+}
+
+#else
+
+static const VecKernels *kernels = &scalar_kernels;
+
+#endif
+
+void vec_add(int32_t *dst, const int32_t *src, size_t n)
+{
+    kernels->add(dst, src, n);
+}
+
+void vec_sub(int32_t *dst, const int32_t *src, size_t n)
+{
+    kernels->sub(dst, src, n);
+}
+
+void vec_mul(int32_t *dst, const int32_t *src, size_t n)
+{
+    kernels->mul(dst, src, n);
+}
+
+void vec_fill(int32_t *dst, int32_t value, size_t n)
+{
+    kernels->fill(dst, value, n);
+}
+
+int32_t vec_sum(const int32_t *src, size_t n)
+{
+    return kernels->sum(src, n);
+}
+
+int32_t vec_min(const int32_t *src, size_t n)
+{
+    return kernels->min(src, n);
+}
+
+int32_t vec_max(const int32_t *src, size_t n)
+{
+    return kernels->max(src, n);
+}
+
+int32_t vec_dot(const int32_t *a, const int32_t *b, size_t n)
+{
+    return kernels->dot(a, b, n);
+}
+
+size_t vec_cmp(const int32_t *a, const int32_t *b, size_t n)
+{
+    return kernels->cmp(a, b, n);
+}
+
+const char *vec_isa(void)
+{
+    return kernels->isa;
+}
@@ -0,0 +1,23 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernels behind the range opcodes. The widest implementation the CPU
+// supports (AVX2, SSE2 or plain C) is picked once at startup, all of
+// them wrap around on overflow like the scalar instructions. Callers
+// check the ranges, the element-wise kernels expect dst and src to be
+// either the same range or disjoint
+void vec_add(int32_t *dst, const int32_t *src, size_t n);
+void vec_sub(int32_t *dst, const int32_t *src, size_t n);
+void vec_mul(int32_t *dst, const int32_t *src, size_t n);
+void vec_fill(int32_t *dst, int32_t value, size_t n);
+int32_t vec_sum(const int32_t *src, size_t n);
+int32_t vec_min(const int32_t *src, size_t n); // INT32_MAX if n is 0
+int32_t vec_max(const int32_t *src, size_t n); // INT32_MIN if n is 0
+int32_t vec_dot(const int32_t *a, const int32_t *b, size_t n);
+size_t vec_cmp(const int32_t *a, const int32_t *b, size_t n); // first difference, n if equal
+const char *vec_isa(void);
+
+#endif
@@ -1,24 +1,291 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "vm.h"
+#include "code.h"
+#include "jit.h"
+#include "vec.h"
 #include "program.h"
 
+static LoopResult run(Vm *vm, size_t slice, const void ***handlers);
+static void vm_jit_free(Vm *vm);
+
 // Interpreter
 void vm_init(Vm *vm)
 {
     Program *program = (Program *)malloc(sizeof(Program));
     program_init(program);
     vm->program = program;
-
-    // Clear registers
-    vm_setreg(vm);
+    vm->owned = program;
+    vm->image = NULL;
+
+    Code *code = (Code *)malloc(sizeof(Code));
+    code_init(code);
+    vm->code = code;
+    vm->owned_code = code;
+    vm->prepared = false;
+    vm->jit_enabled = false;
+    vm->jit = NULL;
+    vm->slice = CONTEXT_SIZE;
+
+    vm->memory = NULL;
+    if (!vm_resize(vm, MEMORY_SIZE))
+        abort();
 }
 
 void vm_deinit(Vm *vm)
 {
+    vm_unbind(vm);
     program_deinit(vm->program);
     free(vm->program);
+    code_deinit(vm->code);
+    free(vm->code);
+    vm_jit_free(vm);
+    munmap(vm->memory, vm_memory_size(vm) * sizeof(int32_t));
+}
+
+// Make the VM of a closed connection as good as new for the next one.
+// Program and code keep their buffers. Memory keeps its mapping when it
+// has the default size, and is only cleared if a program ran on it
+void vm_recycle(Vm *vm)
+{
+    vm_unbind(vm);
+    program_clear(vm->program);
+    vm_jit_free(vm);
+    vm->jit_enabled = false;
+    vm->slice = CONTEXT_SIZE;
+
+    if (vm_memory_size(vm) != MEMORY_SIZE) {
+        if (!vm_resize(vm, MEMORY_SIZE))
+            abort();
+        return;
+    }
+
+    if (vm->dirty)
+        memset(vm->memory, 0, MEMORY_SIZE * sizeof(int32_t));
+    vm->dirty = false;
+    vm_invalidate(vm);
+    vm_setreg(vm);
+}
+
+static void jit_release(Jit *jit)
+{
+    if (jit) {
+        jit_free(jit);
+        free(jit);
+    }
+}
+
+// The native code of an image belongs to the image
+static void vm_jit_free(Vm *vm)
+{
+    if (vm->code == vm->owned_code)
+        jit_release(vm->jit);
+    vm->jit = NULL;
+}
+
+// Back to the owned program, which is empty
+void vm_unbind(Vm *vm)
+{
+    if (!vm->image)
+        return;
+
+    vm_jit_free(vm);
+    vm->code = vm->owned_code;
+    vm->program = vm->owned;
+    image_release(vm->image);
+    vm->image = NULL;
+    vm_invalidate(vm);
+}
+
+// Verify the program and rebuild its pre-decoded form, on failure
+// index is set to the offending instruction. The first VM to prepare
+// an image does it for all of them, those with another memory size or
+// JIT setting prepare a copy of their own
+InstResult vm_prepare(Vm *vm, size_t *index)
+{
+    if (vm->prepared)
+        return OK;
+
+    const void **handlers;
+    run(NULL, 0, &handlers);
+
+    vm_jit_free(vm);
+    vm->code = vm->owned_code;
+
+    Image *image = vm->image;
+    uint32_t memory_size = vm_memory_size(vm);
+    if (image && image->code) {
+        if (image->memory_size == memory_size && image->jit_enabled == vm->jit_enabled) {
+            vm->code = image->code;
+            vm->jit = image->jit;
+            vm->prepared = true;
+            return OK;
+        }
+        image = NULL;
+    }
+
+    Code *code = vm->owned_code;
+    if (image) {
+        code = (Code *)malloc(sizeof(Code));
+        if (!code || !code_init(code)) {
+            free(code);
+            code = vm->owned_code;
+            image = NULL;
+        }
+    }
+
+    InstResult res = code_build(code, vm->program, memory_size, handlers, index);
+    if (res != OK) {
+        if (image) {
+            code_deinit(code);
+            free(code);
+        }
+        return res;
+    }
+
+    // Programs the JIT can't translate keep running in the interpreter
+    Jit *jit = NULL;
+    if (vm->jit_enabled) {
+        jit = (Jit *)calloc(1, sizeof(Jit));
+        if (jit && !jit_compile(jit, vm->program, memory_size)) {
+            free(jit);
+            jit = NULL;
+        }
+    }
+
+    if (image) {
+        image->code = code;
+        image->jit = jit;
+        image->memory_size = memory_size;
+        image->jit_enabled = vm->jit_enabled;
+    }
+    vm->code = code;
+    vm->jit = jit;
+    vm->prepared = true;
+    return OK;
+}
+
+// Run image from now on instead of the program of vm
+void vm_bind(Vm *vm, Image *image)
+{
+    image->refs++;
+    vm_unbind(vm);
+    program_clear(vm->owned);
+    vm->image = image;
+    vm->program = &image->program;
+    vm_invalidate(vm);
+}
+
+// Program of vm to be changed, copied out of the image it is bound to
+// first. NULL if there is no memory for the copy
+Program *vm_edit(Vm *vm)
+{
+    if (!vm->image)
+        return vm->program;
+
+    Program *image = &vm->image->program;
+    program_clear(vm->owned);
+    Instruction *dst = program_reserve(vm->owned, program_size(image));
+    if (!dst)
+        return NULL;
+    memcpy(dst, program_data(image), program_size(image) * sizeof(Instruction));
+    program_extend(vm->owned, program_size(image));
+
+    vm_unbind(vm);
+    return vm->program;
+}
+
+// Image holding a copy of the size instructions of insts, with one
+// reference for the caller. NULL if it can't be allocated
+Image *image_new(const Instruction *insts, size_t size)
+{
+    Image *image = (Image *)calloc(1, sizeof(Image));
+    if (!image)
+        return NULL;
+
+    if (!program_init(&image->program)
+            || !program_merge(&image->program, (Instruction *)insts, size)) {
+        program_deinit(&image->program);
+        free(image);
+        return NULL;
+    }
+
+    image->refs = 1;
+    return image;
+}
+
+void image_release(Image *image)
+{
+    if (--image->refs)
+        return;
+
+    program_deinit(&image->program);
+    if (image->code) {
+        code_deinit(image->code);
+        free(image->code);
+    }
+    jit_release(image->jit);
+    free(image);
+}
+
+// Must be called whenever the program is modified
+void vm_invalidate(Vm *vm)
+{
+    vm->prepared = false;
+}
+
+// Replace the address space with a zeroed one of size words, which must
+// be a power of two. Nothing is backed until the guest touches it
+bool vm_resize(Vm *vm, uint32_t size)
+{
+    int32_t *memory = mmap(NULL, size * sizeof(int32_t), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "Failed to map guest memory\n");
+        return false;
+    }
+
+    if (vm->memory)
+        munmap(vm->memory, vm_memory_size(vm) * sizeof(int32_t));
+    vm->memory = memory;
+    vm->memory_mask = size - 1;
+    vm->dirty = false;
+
+    // Static operands were verified against the old size
+    vm_invalidate(vm);
+    vm_setreg(vm);
+    return true;
+}
+
+uint32_t vm_memory_size(Vm *vm)
+{
+    return vm->memory_mask + 1;
+}
+
+// Pages of guest memory backed so far
+size_t vm_touched_pages(Vm *vm)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = vm_memory_size(vm) * sizeof(int32_t);
+    size_t pages = (bytes + page - 1) / page;
+
+    unsigned char *vec = malloc(pages);
+    if (vec == NULL || mincore(vm->memory, bytes, vec) < 0) {
+        free(vec);
+        return 0;
+    }
+
+    size_t touched = 0;
+    for (size_t i = 0; i < pages; i++) {
+        touched += vec[i] & 1;
+    }
+
+    free(vec);
+    return touched;
 }
 
 void vm_setreg(Vm *vm)
@@ -30,6 +297,30 @@ void vm_setreg(Vm *vm)
     vm->memory[PC] = 0;
     vm->memory[BP] = SB;
     vm->memory[SP] = SB;
+    vm->timer = 0;
+    vm->fault = OK;
+    memset(vm->jit_stats, 0, sizeof(vm->jit_stats));
+    uint32_t size = vm_memory_size(vm);
+    heap_init(&vm->heap, HEAP_BASE(size), size);
+}
+
+// Pass n arguments to the program about to start, after vm_setreg().
+// The first ARG_REGS go to R0 to R3 and the rest are pushed in order,
+// the last one on top. False if they don't fit in the stack
+bool vm_setargs(Vm *vm, const int32_t *args, size_t n)
+{
+    size_t pushed = n > ARG_REGS ? n - ARG_REGS : 0;
+    if (SB + pushed > (size_t)vm->heap.base)
+        return false;
+
+    for (size_t i = 0; i < n && i < ARG_REGS; i++) {
+        vm->memory[R0 + i] = args[i];
+    }
+    for (size_t i = 0; i < pushed; i++) {
+        vm->memory[SB + i] = args[ARG_REGS + i];
+    }
+    vm->memory[SP] = (int32_t)(SB + pushed);
+    return true;
 }
 
 // Memory
@@ -40,57 +331,581 @@ void memory_dump(Vm *vm)
 
 void memory_print(int32_t *memory, size_t size)
 {
-    for (size_t i = 0; i < size && i < MEMORY_SIZE; i++) {
+    for (size_t i = 0; i < size; i++) {
         printf("[0x%.4zx]: %d\n", i, ((int *)memory)[i]);
     }
 }
 
-// Fetch-execute loop nonblocking
-LoopResult loop(Vm *vm)
+// The size of memory is a power of two so an address is in bounds
+// when none of the bits above the mask are set
+#define CHECK_MEMORY_BOUNDS(arg) \
+        !((uint32_t)(arg) & ~vm->memory_mask)
+
+#define CHECK_STACK_BOUNDS(arg) \
+        (uint32_t)(arg) < (uint32_t)vm->heap.base
+
+#define CHECK_MEMORY_BOUNDS_2(arg1, arg2) \
+        CHECK_MEMORY_BOUNDS(arg1) && CHECK_MEMORY_BOUNDS(arg2)
+
+#define CHECK_MEMORY_BOUNDS_3(arg1, arg2, arg3) \
+        CHECK_MEMORY_BOUNDS(arg1) && CHECK_MEMORY_BOUNDS(arg2) \
+     && CHECK_MEMORY_BOUNDS(arg3)
+
+// Fetch-execute loop nonblocking, runs the pre-decoded code built by
+// vm_prepare() so only addresses computed at runtime are checked. With
+// THREADED_DISPATCH every handler jumps straight to the next one through
+// the label stored in its Op, otherwise a switch dispatches on the
+// opcode. PC and the current op are kept in locals.
+//
+// The time limit, preemption and memory[PC] are only dealt with when a
+// basic block is entered (see code_blocks()): the whole block is charged
+// up front and its ops then run back to back. The ops that read PC start
+// a block of their own and any store landing on PC goes back through the
+// entry as well. A block that would cross the time limit is stepped one
+// op at a time instead, so a program times out on the same instruction
+// as if the limit was checked after every op.
+//
+// It yields once slice instructions ran. When called with handlers set
+// it only returns the dispatch table
+static LoopResult run(Vm *vm, size_t slice, const void ***handlers)
 {
-    Instruction *inst;
+#ifdef THREADED_DISPATCH
+    static const void *labels[DISPATCH_END] = {
+        [ADD]   = &&do_ADD,
+        [ADDI]  = &&do_ADDI,
+        [SUB]   = &&do_SUB,
+        [SUBI]  = &&do_SUBI,
+        [MUL]   = &&do_MUL,
+        [MULI]  = &&do_MULI,
+        [DIV]   = &&do_DIV,
+        [DIVI]  = &&do_DIVI,
+        [MOV]   = &&do_MOV,
+        [MOVI]  = &&do_MOVI,
+        [PUSH]  = &&do_PUSH,
+        [PUSHI] = &&do_PUSHI,
+        [POP]   = &&do_POP,
+        [SALLO] = &&do_SALLO,
+        [SFREE] = &&do_SFREE,
+        [B]     = &&do_B,
+        [BEQ]   = &&do_BEQ,
+        [BEQI]  = &&do_BEQI,
+        [BNE]   = &&do_BNE,
+        [BNEI]  = &&do_BNEI,
+        [BGE]   = &&do_BGE,
+        [BGEI]  = &&do_BGEI,
+        [BLEI]  = &&do_BLEI,
+        [RET]   = &&do_RET,
+        [RETI]  = &&do_RETI,
+        [HALT]  = &&do_HALT,
+        [HALLO] = &&do_HALLO,
+        [HFREE] = &&do_HFREE,
+        [LOAD]  = &&do_LOAD,
+        [STORE] = &&do_STORE,
+        [MCPY]  = &&do_MCPY,
+        [MSET]  = &&do_MSET,
+        [VADD]  = &&do_VADD,
+        [VSUB]  = &&do_VSUB,
+        [VMUL]  = &&do_VMUL,
+        [VDOT]  = &&do_VDOT,
+        [VSUM]  = &&do_VSUM,
+        [VMIN]  = &&do_VMIN,
+        [VMAX]  = &&do_VMAX,
+        [VCMP]  = &&do_VCMP,
+        [MOV_SUBI]     = &&do_MOV_SUBI,
+        [MOV_MOV]      = &&do_MOV_MOV,
+        [SUBI_BEQI]    = &&do_SUBI_BEQI,
+        [SUBI_BNEI]    = &&do_SUBI_BNEI,
+        [ADDI_BNEI]    = &&do_ADDI_BNEI,
+        [ADD_B]        = &&do_ADD_B,
+        [MUL_B]        = &&do_MUL_B,
+        [BEQI_B]       = &&do_BEQI_B,
+        [ADD_MOV_MOV]  = &&do_ADD_MOV_MOV,
+        [MOV_MOV_BEQI] = &&do_MOV_MOV_BEQI,
+        [BLOCK_ENTRY]  = &&block_entry,
+        [CODE_END]     = &&do_CODE_END,
+    };
+
+    if (handlers) {
+        *handlers = labels;
+        return LR_SUCCESS;
+    }
+
+#define TARGET(code) do_##code:
+#define DISPATCH() goto *op->handler
+#define EXECUTE() goto *labels[op->code]
+#else
+    if (handlers) {
+        *handlers = NULL;
+        return LR_SUCCESS;
+    }
+
+#define TARGET(code) case code:
+#define DISPATCH() goto dispatch
+#define EXECUTE() goto execute
+#endif
+
+    int32_t *memory = vm->memory;
+    const uint32_t mask = vm->memory_mask;
+    const uint32_t stack_end = (uint32_t)vm->heap.base;
+    Op *ops = vm->code->ops;
+    size_t size = vm->code->size;
+    size_t pc = (size_t)memory[PC];
     size_t count = 0;
-    while (1) {
-        // Fetch instruction
-        inst = fetch(vm);
+    uint32_t left;
+    Op *op;
+    InstResult res;
+    int32_t sp;
+    int32_t addr;
+
+    if (pc >= size) {
+        return LR_SUCCESS;
+    }
+
+#define NEXT()                                      \
+    do {                                            \
+        op = &ops[pc];                              \
+        pc += op->len;                              \
+        DISPATCH();                                 \
+    } while (0)
+
+#define JUMP()                                      \
+    do {                                            \
+        pc = (size_t)memory[PC];                    \
+        goto jump;                                  \
+    } while (0)
+
+#define FAIL(r)                                     \
+    do {                                            \
+        res = r;                                    \
+        memory[PC] = (int32_t)pc;                   \
+        goto fail;                                  \
+    } while (0)
+
+#define WRITE(addr, val)                            \
+    do {                                            \
+        int32_t at = (addr);                        \
+        memory[at] = (val);                         \
+        if (at == PC)                               \
+            JUMP();                                 \
+    } while (0)
+
+#define IN_MEMORY(addr) !((uint32_t)(addr) & ~mask)
+#define IN_STACK(addr) ((uint32_t)(addr) < stack_end)
+
+#define BRANCH(cond)                                \
+    do {                                            \
+        if (cond)                                   \
+            pc = (size_t)op->dest;                  \
+    } while (0)
+
+    // Execution starts, resumes after a store to PC or lands anywhere
+    // in a block, pc is the index of the next op
+jump:
+    if (pc >= size)
+        goto done;
+    op = &ops[pc];
+    left = op->block ? op->block : code_block_left(vm->code, pc);
+    goto enter;
+
+    // Fallen through or branched to the first op of a block
+block_entry:
+    pc -= op->len;
+    left = op->block;
+
+enter:
+    if (count >= slice)
+        goto context_changed;
+    if (vm->timer + left > TIMER_LIMIT)
+        goto step;
+    vm->timer += left;
+    count += left;
+    pc += op->len;
+    memory[PC] = (int32_t)pc;
+    EXECUTE();
+
+    // The time limit falls inside this block, run it the way the plain
+    // interpreter would: a fused op is charged for the instructions it
+    // covers that ran, up to the one that branched
+step:
+    for (;;) {
+        uint32_t ran = 0;
+        while (ran < op->len) {
+            int32_t at = (int32_t)(pc + ran + 1);
+            memory[PC] = at;
+            res = execute(vm, program_fetch(vm->program, pc + ran));
+            if (res != OK)
+                goto fail;
+            ran++;
+            if (memory[PC] != at)
+                break;
+        }
+
+        size_t next = pc + op->len;
+        pc = (size_t)memory[PC];
+        if (pc >= size)
+            goto done;
+        vm->timer += ran;
+        if (vm->timer > TIMER_LIMIT)
+            goto time_exceeded;
+        if (pc != next || ops[pc].block)
+            goto jump;
+        op = &ops[pc];
+    }
+
+#ifndef THREADED_DISPATCH
+dispatch:
+    if (op->block)
+        goto block_entry;
+execute:
+    switch (op->code) {
+#endif
+
+    TARGET(ADD)
+        WRITE(op->dest, memory[op->arg1] + memory[op->arg2]);
+        NEXT();
+
+    TARGET(ADDI)
+        WRITE(op->dest, memory[op->arg1] + op->arg2);
+        NEXT();
+
+    TARGET(SUB)
+        WRITE(op->dest, memory[op->arg1] - memory[op->arg2]);
+        NEXT();
+
+    TARGET(SUBI)
+        WRITE(op->dest, memory[op->arg1] - op->arg2);
+        NEXT();
+
+    TARGET(MUL)
+        WRITE(op->dest, memory[op->arg1] * memory[op->arg2]);
+        NEXT();
+
+    TARGET(MULI)
+        WRITE(op->dest, memory[op->arg1] * op->arg2);
+        NEXT();
+
+    TARGET(DIV)
+        if (memory[op->arg2] == 0)
+            FAIL(DIVISION_BY_ZERO);
+        if (memory[op->arg2] == -1 && memory[op->arg1] == INT32_MIN)
+            FAIL(DIVISION_OVERFLOW);
+        WRITE(op->dest, memory[op->arg1] / memory[op->arg2]);
+        NEXT();
+
+    TARGET(DIVI)
+        if (op->arg2 == -1 && memory[op->arg1] == INT32_MIN)
+            FAIL(DIVISION_OVERFLOW);
+        WRITE(op->dest, memory[op->arg1] / op->arg2);
+        NEXT();
+
+    TARGET(MOV)
+        WRITE(op->dest, memory[op->arg1]);
+        NEXT();
+
+    TARGET(MOVI)
+        WRITE(op->dest, op->arg1);
+        NEXT();
+
+    TARGET(PUSH)
+        sp = memory[SP];
+        if (!IN_STACK(sp))
+            FAIL(MEMORY_OVERFLOW);
+        memory[sp] = memory[op->dest];
+        memory[SP]++;
+        if (sp == PC)
+            JUMP();
+        NEXT();
+
+    TARGET(PUSHI)
+        sp = memory[SP];
+        if (!IN_STACK(sp))
+            FAIL(MEMORY_OVERFLOW);
+        memory[sp] = op->dest;
+        memory[SP]++;
+        if (sp == PC)
+            JUMP();
+        NEXT();
+
+    TARGET(POP)
+        sp = memory[SP] - 1;
+        if (!IN_STACK(sp))
+            FAIL(MEMORY_OVERFLOW);
+        memory[SP] = sp;
+        WRITE(op->dest, memory[sp]);
+        NEXT();
+
+    TARGET(SALLO)
+        sp = memory[SP] + op->dest;
+        if (!IN_STACK(sp))
+            FAIL(MEMORY_OVERFLOW);
+        memory[SP] = sp;
+        NEXT();
+
+    TARGET(SFREE)
+        sp = memory[SP] - op->dest;
+        if (!IN_STACK(sp))
+            FAIL(MEMORY_OVERFLOW);
+        memory[SP] = sp;
+        NEXT();
+
+    TARGET(B)
+        BRANCH(true);
+        NEXT();
+
+    TARGET(BEQ)
+        BRANCH(memory[op->arg1] == memory[op->arg2]);
+        NEXT();
+
+    TARGET(BEQI)
+        BRANCH(memory[op->arg1] == op->arg2);
+        NEXT();
+
+    TARGET(BNE)
+        BRANCH(memory[op->arg1] != memory[op->arg2]);
+        NEXT();
+
+    TARGET(BNEI)
+        BRANCH(memory[op->arg1] != op->arg2);
+        NEXT();
+
+    TARGET(BGE)
+        BRANCH(memory[op->arg1] >= memory[op->arg2]);
+        NEXT();
+
+    TARGET(BGEI)
+        BRANCH(memory[op->arg1] >= op->arg2);
+        NEXT();
+
+    TARGET(BLEI)
+        BRANCH(memory[op->arg2] >= op->arg1);
+        NEXT();
+
+    TARGET(RET)
+        memory[R0] = memory[op->dest];
+        NEXT();
+
+    TARGET(RETI)
+        memory[R0] = op->dest;
+        NEXT();
+
+    TARGET(HALT)
+        pc = size;
+        NEXT();
+
+    TARGET(HALLO)
+        WRITE(op->dest, heap_alloc(&vm->heap, memory, memory[op->arg1]));
+        NEXT();
+
+    TARGET(HFREE)
+        if (!heap_free(&vm->heap, memory, memory[op->dest]))
+            FAIL(MEMORY_OVERFLOW);
+        NEXT();
+
+    TARGET(LOAD)
+        addr = memory[op->arg1] + op->arg2;
+        if (!IN_MEMORY(addr))
+            FAIL(MEMORY_OVERFLOW);
+        WRITE(op->dest, memory[addr]);
+        NEXT();
+
+    TARGET(STORE)
+        addr = memory[op->dest] + op->arg2;
+        if (!IN_MEMORY(addr))
+            FAIL(MEMORY_OVERFLOW);
+        WRITE(addr, memory[op->arg1]);
+        NEXT();
+
+    // Range ops check their ranges once and may write over PC, they end
+    // their block so going through the entry costs nothing extra
+    TARGET(MCPY)
+    TARGET(MSET)
+    TARGET(VADD)
+    TARGET(VSUB)
+    TARGET(VMUL)
+    TARGET(VDOT)
+    TARGET(VSUM)
+    TARGET(VMIN)
+    TARGET(VMAX)
+    TARGET(VCMP)
+        res = range(vm, op->code, op->dest, op->arg1, op->arg2);
+        if (res != OK)
+            FAIL(res);
+        JUMP();
+
+    // Fused ops, see code_fuse(). None of the instructions they cover
+    // touches memory[PC] so the stores don't need to check for it
+    TARGET(MOV_SUBI)
+        memory[op[0].dest] = memory[op[0].arg1];
+        memory[op[1].dest] = memory[op[1].arg1] - op[1].arg2;
+        NEXT();
+
+    TARGET(MOV_MOV)
+        memory[op[0].dest] = memory[op[0].arg1];
+        memory[op[1].dest] = memory[op[1].arg1];
+        NEXT();
+
+    TARGET(SUBI_BEQI)
+        memory[op[0].dest] = memory[op[0].arg1] - op[0].arg2;
+        if (memory[op[1].arg1] == op[1].arg2)
+            pc = (size_t)op[1].dest;
+        NEXT();
+
+    TARGET(SUBI_BNEI)
+        memory[op[0].dest] = memory[op[0].arg1] - op[0].arg2;
+        if (memory[op[1].arg1] != op[1].arg2)
+            pc = (size_t)op[1].dest;
+        NEXT();
+
+    TARGET(ADDI_BNEI)
+        memory[op[0].dest] = memory[op[0].arg1] + op[0].arg2;
+        if (memory[op[1].arg1] != op[1].arg2)
+            pc = (size_t)op[1].dest;
+        NEXT();
+
+    TARGET(ADD_B)
+        memory[op[0].dest] = memory[op[0].arg1] + memory[op[0].arg2];
+        pc = (size_t)op[1].dest;
+        NEXT();
+
+    TARGET(MUL_B)
+        memory[op[0].dest] = memory[op[0].arg1] * memory[op[0].arg2];
+        pc = (size_t)op[1].dest;
+        NEXT();
+
+    // The B was charged with the BEQI, taking the branch skips it
+    TARGET(BEQI_B)
+        if (memory[op[0].arg1] == op[0].arg2) {
+            pc = (size_t)op[0].dest;
+            vm->timer--;
+            count--;
+        } else {
+            pc = (size_t)op[1].dest;
+        }
+        NEXT();
 
-        // Increment program counter
-        vm->memory[PC]++;
-        count++;
+    TARGET(ADD_MOV_MOV)
+        memory[op[0].dest] = memory[op[0].arg1] + memory[op[0].arg2];
+        memory[op[1].dest] = memory[op[1].arg1];
+        memory[op[2].dest] = memory[op[2].arg1];
+        NEXT();
 
-        // Execute instruction
-        InstResult res = execute(vm, inst);
+    TARGET(MOV_MOV_BEQI)
+        memory[op[0].dest] = memory[op[0].arg1];
+        memory[op[1].dest] = memory[op[1].arg1];
+        if (memory[op[2].arg1] == op[2].arg2)
+            pc = (size_t)op[2].dest;
+        NEXT();
 
-        // Handle result
+    TARGET(CODE_END)
+        goto done;
+
+#ifndef THREADED_DISPATCH
+    default:
+        FAIL(MALFORMED_INSTRUCTION);
+    }
+#endif
+
+fail:
+    vm->fault = res;
+    fprintf(
+        stderr,
+        "Error: %s at instruction %d\n",
+        res_names[res],
+        memory[PC]
+    );
+    return LR_MALFORMED_INSTRUCTION;
+
+done:
+    memory[PC] = (int32_t)pc;
+    return LR_SUCCESS;
+
+time_exceeded:
+    memory[PC] = (int32_t)pc;
+    return LR_TIME_EXCEEDED;
+
+context_changed:
+    memory[PC] = (int32_t)pc;
+    return LR_CONTEXT_CHANGED;
+
+#undef TARGET
+#undef DISPATCH
+#undef EXECUTE
+#undef NEXT
+#undef JUMP
+#undef FAIL
+#undef WRITE
+#undef IN_MEMORY
+#undef IN_STACK
+#undef BRANCH
+}
+
+// Native code accounts whole blocks against the same timer and
+// context budget as the interpreter and preempts at back-edges, the
+// instructions it bails out on run in the interpreter
+static LoopResult run_jit(Vm *vm)
+{
+    if ((size_t)vm->memory[PC] >= program_size(vm->program)) {
+        return LR_SUCCESS;
+    }
+
+    int32_t budget = TIMER_LIMIT + 1 - (int32_t)vm->timer;
+    if (budget > (int32_t)vm->slice)
+        budget = (int32_t)vm->slice;
+
+    int32_t executed;
+    JitResult res = jit_exec(vm->jit, vm->memory, budget, &executed);
+    vm->timer += executed;
+    vm->jit_stats[JIT_NATIVE] += (uint32_t)executed;
+
+    switch (res) {
+        case JIT_END:
+            // The interpreter doesn't hold the instruction that ends the
+            // program against the limit, only those that came before it
+            if (vm->timer > TIMER_LIMIT + 1)
+                return LR_TIME_EXCEEDED;
+            return LR_SUCCESS;
+        case JIT_PREEMPT:
+            if (vm->timer > TIMER_LIMIT)
+                return LR_TIME_EXCEEDED;
+            return LR_CONTEXT_CHANGED;
+        case JIT_BAIL:
+        default:
+            vm->jit_stats[JIT_BAILS]++;
+            // Whole blocks may have overrun the slice already
+            if ((uint32_t)executed >= vm->slice)
+                return run(vm, 0, NULL);
+            return run(vm, vm->slice - (uint32_t)executed, NULL);
+    }
+}
+
+LoopResult loop(Vm *vm)
+{
+    vm->dirty = true;
+    if (!vm->prepared) {
+        size_t index;
+        InstResult res = vm_prepare(vm, &index);
         if (res != OK) {
             fprintf(
                 stderr,
-                "Error: %s at instruction %d\n",
+                "Error: %s at instruction %zu\n",
                 res_names[res],
-                vm->memory[PC]
+                index
             );
+            vm->fault = res;
             return LR_MALFORMED_INSTRUCTION;
         }
+    }
 
-        // Check if program finished
-        if (vm->memory[PC] >= program_size(vm->program)) {
-            return LR_SUCCESS;
-        }
-
-        // Check if timer expired
-        if (vm->timer++ == TIMER_LIMIT) {
-            return LR_TIME_EXCEEDED;
-        }
+    if (vm->jit)
+        return run_jit(vm);
 
-        // Check if execution exceeded context size
-        if (count == CONTEXT_SIZE) {
-            return LR_CONTEXT_CHANGED;
-        }
-    }
+    return run(vm, vm->slice, NULL);
 }
 
 bool loop_dbg(Vm *vm)
 {
+    vm->dirty = true;
+
     // Fetch instruction
     Instruction *inst = fetch(vm);
 
@@ -171,6 +986,22 @@ InstResult execute(Vm *vm, Instruction *inst)
     case RET:   res = ret(vm, dest); break;
     case RETI:  res = reti(vm, dest); break;
     case HALT:  res = halt(vm); break;
+    case HALLO: res = hallo(vm, dest, arg1); break;
+    case HFREE: res = hfree(vm, dest); break;
+    case LOAD:  res = load(vm, dest, arg1, arg2); break;
+    case STORE: res = store(vm, dest, arg1, arg2); break;
+    case MCPY:
+    case MSET:
+    case VADD:
+    case VSUB:
+    case VMUL:
+    case VDOT:
+    case VSUM:
+    case VMIN:
+    case VMAX:
+    case VCMP:
+        res = range(vm, inst->code, dest, arg1, arg2);
+        break;
     default:
         res = MALFORMED_INSTRUCTION;
         break;
@@ -179,18 +1010,6 @@ InstResult execute(Vm *vm, Instruction *inst)
     return res;
 }
 
-#define CHECK_MEMORY_BOUNDS(arg) \
-        arg >= 0 && arg < MEMORY_SIZE
-
-#define CHECK_MEMORY_BOUNDS_2(arg1, arg2) \
-        arg1 >= 0 && arg1 < MEMORY_SIZE \
-     && arg2 >= 0 && arg2 < MEMORY_SIZE
-
-#define CHECK_MEMORY_BOUNDS_3(arg1, arg2, arg3) \
-        arg1 >= 0 && arg1 < MEMORY_SIZE \
-     && arg2 >= 0 && arg2 < MEMORY_SIZE \
-     && arg3 >= 0 && arg3 < MEMORY_SIZE
-
 // Instructions
 InstResult add(Vm *vm, int dest, int arg1, int arg2)
 {
@@ -258,6 +1077,8 @@ InstResult ddiv(Vm *vm, int dest, int arg1, int arg2)
         int den = vm->memory[arg2];
         if (den == 0)
             return DIVISION_BY_ZERO;
+        if (den == -1 && vm->memory[arg1] == INT32_MIN)
+            return DIVISION_OVERFLOW;
 
         vm->memory[dest] = vm->memory[arg1] / den;
         return OK;
@@ -272,6 +1093,8 @@ InstResult divi(Vm *vm, int dest, int arg1, int arg2)
         return DIVISION_BY_ZERO;
 
     if (CHECK_MEMORY_BOUNDS_2(dest, arg1)) {
+        if (arg2 == -1 && vm->memory[arg1] == INT32_MIN)
+            return DIVISION_OVERFLOW;
         vm->memory[dest] = vm->memory[arg1] / arg2;
         return OK;
     }
@@ -291,7 +1114,7 @@ InstResult movi(Vm *vm, int dest, int arg1)
 
 InstResult push(Vm *vm, int dest)
 {
-    if (CHECK_MEMORY_BOUNDS_2(vm->memory[SP], dest)) {
+    if (CHECK_STACK_BOUNDS(vm->memory[SP]) && CHECK_MEMORY_BOUNDS(dest)) {
         vm->memory[vm->memory[SP]] = vm->memory[dest];
         vm->memory[SP]++;
         return OK;
@@ -302,7 +1125,7 @@ InstResult push(Vm *vm, int dest)
 
 InstResult pushi(Vm *vm, int dest)
 {
-    if (CHECK_MEMORY_BOUNDS(vm->memory[SP])) {
+    if (CHECK_STACK_BOUNDS(vm->memory[SP])) {
         vm->memory[vm->memory[SP]] = dest;
         vm->memory[SP]++;
         return OK;
@@ -313,7 +1136,7 @@ InstResult pushi(Vm *vm, int dest)
 
 InstResult pop(Vm *vm, int dest)
 {
-    if (CHECK_MEMORY_BOUNDS(dest) && vm->memory[SP] > 0) {
+    if (CHECK_MEMORY_BOUNDS(dest) && vm->memory[SP] > 0 && vm->memory[SP] <= vm->heap.base) {
         vm->memory[SP]--;
         vm->memory[dest] = vm->memory[vm->memory[SP]];
         return OK;
@@ -324,7 +1147,7 @@ InstResult pop(Vm *vm, int dest)
 
 InstResult sallo(Vm *vm, int dest)
 {
-    if (CHECK_MEMORY_BOUNDS(vm->memory[SP] + dest)) {
+    if (CHECK_STACK_BOUNDS(vm->memory[SP] + dest)) {
         vm->memory[SP] += dest;
         return OK;
     }
@@ -334,7 +1157,7 @@ InstResult sallo(Vm *vm, int dest)
 
 InstResult sfree(Vm *vm, int dest)
 {
-    if (CHECK_MEMORY_BOUNDS(vm->memory[SP] - dest)) {
+    if (CHECK_STACK_BOUNDS(vm->memory[SP] - dest)) {
         vm->memory[SP] -= dest;
         return OK;
     }
@@ -444,6 +1267,148 @@ InstResult halt(Vm *vm)
     return OK;
 }
 
+InstResult hallo(Vm *vm, int dest, int arg1)
+{
+    if (CHECK_MEMORY_BOUNDS_2(dest, arg1)) {
+        vm->memory[dest] = heap_alloc(&vm->heap, vm->memory, vm->memory[arg1]);
+        return OK;
+    }
+
+    return MEMORY_OVERFLOW;
+}
+
+InstResult hfree(Vm *vm, int dest)
+{
+    if (CHECK_MEMORY_BOUNDS(dest)
+        && heap_free(&vm->heap, vm->memory, vm->memory[dest])) {
+        return OK;
+    }
+
+    return MEMORY_OVERFLOW;
+}
+
+InstResult load(Vm *vm, int dest, int arg1, int arg2)
+{
+    if (CHECK_MEMORY_BOUNDS_2(dest, arg1)
+        && CHECK_MEMORY_BOUNDS(vm->memory[arg1] + arg2)) {
+        vm->memory[dest] = vm->memory[vm->memory[arg1] + arg2];
+        return OK;
+    }
+
+    return MEMORY_OVERFLOW;
+}
+
+InstResult store(Vm *vm, int dest, int arg1, int arg2)
+{
+    if (CHECK_MEMORY_BOUNDS_2(dest, arg1)
+        && CHECK_MEMORY_BOUNDS(vm->memory[dest] + arg2)) {
+        vm->memory[vm->memory[dest] + arg2] = vm->memory[arg1];
+        return OK;
+    }
+
+    return MEMORY_OVERFLOW;
+}
+
+#define CHECK_RANGE_BOUNDS(addr, n) \
+        (uint32_t)(n) <= vm->memory_mask + 1 \
+     && (uint32_t)(addr) <= vm->memory_mask + 1 - (uint32_t)(n)
+
+// Whole range instructions. The operands are slots holding the
+// addresses and length, each range is bounds checked once:
+//   mcpy dst src n    copy n words from src to dst (overlap allowed)
+//   mset dst val n    fill n words at dst with memory[val]
+//   vadd dst src n    dst[i] += src[i], likewise vsub and vmul
+//   vsum res src n    memory[res] = sum of n words at src
+//   vmin res src n    smallest word or INT32_MAX if n is 0
+//   vmax res src n    largest word or INT32_MIN if n is 0
+//   vdot res a b      dot product of memory[res] words at a and b
+//   vcmp res a b      index of the first of memory[res] words that
+//                     differs between a and b, memory[res] if none
+InstResult range(Vm *vm, uint32_t code, int dest, int arg1, int arg2)
+{
+    if (!(CHECK_MEMORY_BOUNDS_3(dest, arg1, arg2)))
+        return MEMORY_OVERFLOW;
+
+    int32_t *memory = vm->memory;
+    int32_t n;
+    int32_t a = memory[arg1];
+    int32_t b = memory[arg2];
+
+    switch (code) {
+    case VDOT:
+    case VCMP:
+        n = memory[dest];
+        if (!(CHECK_RANGE_BOUNDS(a, n) && CHECK_RANGE_BOUNDS(b, n)))
+            return MEMORY_OVERFLOW;
+        if (code == VDOT)
+            memory[dest] = vec_dot(&memory[a], &memory[b], n);
+        else
+            memory[dest] = (int32_t)vec_cmp(&memory[a], &memory[b], n);
+        return OK;
+    case VSUM:
+    case VMIN:
+    case VMAX:
+        n = b;
+        if (!(CHECK_RANGE_BOUNDS(a, n)))
+            return MEMORY_OVERFLOW;
+        if (code == VSUM)
+            memory[dest] = vec_sum(&memory[a], n);
+        else if (code == VMIN)
+            memory[dest] = vec_min(&memory[a], n);
+        else
+            memory[dest] = vec_max(&memory[a], n);
+        return OK;
+    case MSET:
+        n = b;
+        if (!(CHECK_RANGE_BOUNDS(memory[dest], n)))
+            return MEMORY_OVERFLOW;
+        vec_fill(&memory[memory[dest]], a, n);
+        return OK;
+    case MCPY:
+    case VADD:
+    case VSUB:
+    case VMUL:
+        break;
+    default:
+        return MALFORMED_INSTRUCTION;
+    }
+
+    int32_t dst = memory[dest];
+    n = b;
+    if (!(CHECK_RANGE_BOUNDS(dst, n) && CHECK_RANGE_BOUNDS(a, n)))
+        return MEMORY_OVERFLOW;
+
+    if (code == MCPY) {
+        memmove(&memory[dst], &memory[a], n * sizeof(int32_t));
+        return OK;
+    }
+
+    // The kernels work a vector at a time, partially overlapping ranges
+    // go through a copy so the result doesn't depend on the width
+    int32_t *src = &memory[a];
+    int32_t *copy = NULL;
+    if (dst != a && dst < a + n && a < dst + n) {
+        copy = malloc(n * sizeof(int32_t));
+        if (copy == NULL)
+            return MEMORY_OVERFLOW;
+        memcpy(copy, src, n * sizeof(int32_t));
+        src = copy;
+    }
+
+    if (code == VADD)
+        vec_add(&memory[dst], src, n);
+    else if (code == VSUB)
+        vec_sub(&memory[dst], src, n);
+    else
+        vec_mul(&memory[dst], src, n);
+
+    free(copy);
+    return OK;
+}
+
+#undef CHECK_RANGE_BOUNDS
+
 #undef CHECK_MEMORY_BOUNDS
+#undef CHECK_STACK_BOUNDS
 #undef CHECK_MEMORY_BOUNDS_2
 #undef CHECK_MEMORY_BOUNDS_3
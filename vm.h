@@ -2,12 +2,14 @@
 #define VM_H
 
 #include "program.h"
+#include "heap.h"
 
 typedef enum {
     OK,
     MEMORY_OVERFLOW,
     MALFORMED_INSTRUCTION,
-    DIVISION_BY_ZERO
+    DIVISION_BY_ZERO,
+    DIVISION_OVERFLOW // INT_MIN / -1
 } InstResult;
 
 #define RES_STRING(res) #res
@@ -15,7 +17,8 @@ static const char *res_names[] = {
     RES_STRING(OK),
     RES_STRING(MEMORY_OVERFLOW),
     RES_STRING(MALFORMED_INSTRUCTION),
-    RES_STRING(DIVISION_BY_ZERO)
+    RES_STRING(DIVISION_BY_ZERO),
+    RES_STRING(DIVISION_OVERFLOW)
 };
 #undef RES_STRING
 
@@ -29,15 +32,61 @@ static const char *res_names[] = {
 #define BP 6 // vm->memory[BP] base pointer
 #define SP 7 // vm->memory[SP] stack pointer
 #define SB 8 // vm->memory[SB] stack base
+#define ARG_REGS 4 // arguments passed in R0 to R3, the rest on the stack
 
-#define CONTEXT_SIZE 8
-#define MEMORY_SIZE 1024
+#define CONTEXT_SIZE 8 // default and smallest time slice in instructions
 #define TIMER_LIMIT 0xffff
 
+// Size of the address space in words, a power of two negotiated with
+// SETUP. The stack grows up from SB to the middle of it, HALLO hands
+// out blocks from the middle to the end
+#define MEMORY_SIZE 1024 // default and smallest size
+#define MEMORY_SIZE_MAX (1 << 24)
+#define HEAP_BASE(size) ((size) / 2)
+
+// Verified and pre-decoded program, see code.h
+typedef struct Code Code;
+
+// Native translation of a program, see jit.h
+typedef struct Jit Jit;
+
+// Program shared read-only by the VMs bound to it with vm_bind(), so
+// that it is held, verified and pre-decoded once for all of them. A VM
+// copies it before changing it, see vm_edit(). Freed with the last
+// reference, which is only ever taken on the thread serving the VMs
+typedef struct {
+    Program program;
+    Code *code; // built by the first VM to prepare it, NULL until then
+    Jit *jit; // built along with code, NULL if it runs in the interpreter
+    uint32_t memory_size; // code was verified against
+    bool jit_enabled; // code was prepared with
+    uint32_t refs;
+} Image;
+
+// Counters read by DUMP with the DUMP_JIT section
+typedef enum {
+    JIT_NATIVE, // instructions run as native code
+    JIT_BAILS, // exits to the interpreter
+    JIT_STAT_COUNT
+} JitStat;
+
 typedef struct {
-    Program *program;
-    int32_t memory[MEMORY_SIZE];
-    uint16_t timer;
+    Program *program; // owned, or the program of image
+    Code *code; // owned_code, or the code of image
+    Image *image; // NULL while the program is private
+    Program *owned;
+    Code *owned_code;
+    bool prepared; // code is up to date with program
+    bool jit_enabled; // translate programs to native code when prepared
+    Jit *jit; // NULL if the program runs in the interpreter
+    uint32_t jit_stats[JIT_STAT_COUNT]; // since vm_setreg()
+    int32_t *memory; // reserved up front, pages are backed on first touch
+    uint32_t memory_mask; // size of memory - 1
+    uint32_t timer; // instructions executed since vm_setreg()
+    uint32_t slice; // instructions loop() may run before it yields
+    InstResult fault; // why loop() last failed, OK since vm_setreg()
+    Heap heap; // reset by vm_setreg()
+    bool dirty; // memory may hold more than vm_setreg() wrote
 } Vm;
 
 typedef enum {
@@ -45,12 +94,25 @@ typedef enum {
     LR_TIME_EXCEEDED,
     LR_MALFORMED_INSTRUCTION,
     LR_SUCCESS,
+    LR_ABORTED, // the server had no room to keep running it
 } LoopResult;
 
 // interpreter
 void vm_init(Vm *vm);
 void vm_deinit(Vm *vm);
+void vm_recycle(Vm *vm);
 void vm_setreg(Vm *vm);
+bool vm_setargs(Vm *vm, const int32_t *args, size_t n);
+InstResult vm_prepare(Vm *vm, size_t *index);
+void vm_bind(Vm *vm, Image *image);
+void vm_unbind(Vm *vm);
+Program *vm_edit(Vm *vm);
+Image *image_new(const Instruction *insts, size_t size);
+void image_release(Image *image);
+bool vm_resize(Vm *vm, uint32_t size);
+uint32_t vm_memory_size(Vm *vm);
+size_t vm_touched_pages(Vm *vm);
+void vm_invalidate(Vm *vm);
 
 // Memory
 void memory_dump(Vm *vm);
@@ -80,8 +142,13 @@ InstResult pushi(Vm *vm, int dest);
 InstResult pop(Vm *vm, int dest);
 InstResult sallo(Vm *vm, int dest);
 InstResult sfree(Vm *vm, int dest);
-InstResult hallo(Vm *vm, int dest);
+InstResult hallo(Vm *vm, int dest, int arg1);
 InstResult hfree(Vm *vm, int dest);
+InstResult load(Vm *vm, int dest, int arg1, int arg2);
+InstResult store(Vm *vm, int dest, int arg1, int arg2);
+
+// Range instructions, see range()
+InstResult range(Vm *vm, uint32_t code, int dest, int arg1, int arg2);
 
 // Control instruction
 InstResult beq(Vm *vm, int dest, int arg1, int arg2);